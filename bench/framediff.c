@@ -0,0 +1,203 @@
+/**
+ * Measures the cost of diffing a frame of a 300x100 screen, see framediff.h, for the kinds of output a terminal
+ * commonly sees. Each scenario changes the grid the way the screen would, then times diffFrame() alone. The
+ * records are applied to a copy of the previous frame and checked against the displayed cells, outside the timing.
+ *
+ * Built and run with `make bench`.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "terminal.h"
+#include "framediff.h"
+#include "grid.h"
+
+#define COLUMNS 300
+#define ROWS 100
+// Grid rows in the ring the screen rows are taken from, so that scrolling reuses rows like the primary screen.
+#define RING_ROWS (ROWS * 2)
+#define FRAMES 20000
+
+struct RenderContext renderContext;
+
+static struct ShaderRow rowMap[ROWS];
+static int ringOffset;
+static unsigned int shadow[ROWS * COLUMNS];
+static unsigned int seed = 1;
+static int failures;
+
+static unsigned int nextRandom() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static int getRingRow(int y) {
+    return (ringOffset + y) % RING_ROWS;
+}
+
+static void updateRowMap() {
+    for (int y = 0; y < ROWS; y++) {
+        rowMap[y] = getShaderRow(getRingRow(y));
+    }
+}
+
+static void writeCells(int row, int x, int count, unsigned int cell) {
+    unsigned int *cells = getWritableRow(row, x + count);
+    for (int i = 0; i < count; i++) {
+        cells[x + i] = cell + i;
+    }
+    markCellsDirty(row, x, x + count);
+}
+
+/**
+ * Prints a line of text at the bottom of the screen after scrolling it up by one row, like `cat` of a large file.
+*/
+static void printLine() {
+    ringOffset = (ringOffset + 1) % RING_ROWS;
+    const int row = getRingRow(ROWS - 1);
+    clearCells(row, 0, 0);
+    writeCells(row, 0, 40 + nextRandom() % (COLUMNS - 40), packCell(0x21 + nextRandom() % 64, 0));
+}
+
+static void idle(int frame) {
+}
+
+static void typeCharacter(int frame) {
+    writeCells(getRingRow(ROWS - 1), frame % COLUMNS, 1, packCell(0x41 + frame % 26, 0));
+}
+
+static void scrollLine(int frame) {
+    printLine();
+}
+
+static void scrollTenLines(int frame) {
+    for (int i = 0; i < 10; i++) {
+        printLine();
+    }
+}
+
+/**
+ * Rewrites every row with the cells it already has, like a full-screen program repainting an unchanged screen.
+*/
+static void redraw(int frame) {
+    for (int y = 0; y < ROWS; y++) {
+        const int row = getRingRow(y);
+        markCellsDirty(row, 0, renderContext.grid->blankFrom[row]);
+    }
+}
+
+static void changeEveryCell(int frame) {
+    for (int y = 0; y < ROWS; y++) {
+        writeCells(getRingRow(y), 0, COLUMNS, packCell(0x21 + (frame + y) % 64, frame % 7));
+    }
+}
+
+/**
+ * Scrolls the rows between a header and a status line, like a pager, by rotating them within the ring.
+*/
+static void scrollRegion(int frame) {
+    const int row = rowMap[1].row;
+    for (int y = 1; y < ROWS - 2; y++) {
+        rowMap[y] = rowMap[y + 1];
+    }
+    clearCells(row, 0, 0);
+    writeCells(row, 0, COLUMNS / 2, packCell(0x30 + frame % 10, 1));
+    rowMap[ROWS - 2] = getShaderRow(row);
+}
+
+static void fillScreen() {
+    for (int y = 0; y < RING_ROWS; y++) {
+        clearCells(y, 0, 0);
+        writeCells(y, 0, 20 + (y * 37) % (COLUMNS - 20), packCell(0x21 + y % 64, y % 5));
+    }
+}
+
+/**
+ * Applies the records to the copy of the previous frame, and checks that the copy now shows the displayed cells.
+*/
+static void checkChanges(const struct FrameChange *changes, int count) {
+    for (int i = 0; i < count; i++) {
+        const struct FrameChange *change = &changes[i];
+        if (change->type == FRAME_RESIZE) {
+            memset(shadow, 0, sizeof(shadow));
+        } else if (change->type == FRAME_SCROLL) {
+            const int distance = change->count > 0 ? change->count : -change->count;
+            const int moved = change->bottom - change->top + 1 - distance;
+            const int from = change->count > 0 ? change->top + distance : change->top;
+            const int to = change->count > 0 ? change->top : change->top + distance;
+            const int blankTop = change->count > 0 ? change->bottom - distance + 1 : change->top;
+            memmove(&shadow[to * COLUMNS], &shadow[from * COLUMNS], moved * COLUMNS * sizeof(unsigned int));
+            memset(&shadow[blankTop * COLUMNS], 0, distance * COLUMNS * sizeof(unsigned int));
+        } else {
+            const unsigned int *cells = getFrameRow(change->top);
+            memcpy(&shadow[change->top * COLUMNS + change->start], &cells[change->start],
+                (change->end - change->start) * sizeof(unsigned int));
+        }
+    }
+
+    const struct CellGrid *grid = renderContext.grid;
+    for (int y = 0; y < ROWS; y++) {
+        const struct ShaderRow *row = &rowMap[y];
+        for (int x = 0; x < COLUMNS; x++) {
+            const unsigned int cell = x < row->blankFrom ? grid->cells[row->row * COLUMNS + x] : row->blank;
+            if (shadow[y * COLUMNS + x] != cell) {
+                failures++;
+                return;
+            }
+        }
+    }
+}
+
+static double getTime() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void run(const char *name, void (*change)(int frame), int updatesRowMap) {
+    double elapsed = 0;
+    long long records = 0;
+    for (int frame = 0; frame < FRAMES; frame++) {
+        change(frame);
+        if (updatesRowMap) {
+            updateRowMap();
+        }
+
+        int count;
+        const double start = getTime();
+        const struct FrameChange *changes = diffFrame(rowMap, &count);
+        elapsed += getTime() - start;
+        records += count;
+        checkChanges(changes, count);
+    }
+    printf("%-16s %8.0f ns/frame %6.1f records/frame\n", name, elapsed / FRAMES * 1e9, (double) records / FRAMES);
+}
+
+int main() {
+    renderContext.grid = createGrid(COLUMNS, RING_ROWS);
+    renderContext.screenTileSize = (struct Vec2i) { COLUMNS, ROWS };
+    fillScreen();
+    updateRowMap();
+    int count;
+    const struct FrameChange *changes = diffFrame(rowMap, &count);
+    checkChanges(changes, count);
+
+    printf("Frame diff of a %dx%d screen, %d frames each\n", COLUMNS, ROWS, FRAMES);
+    run("idle", idle, 1);
+    run("typing", typeCharacter, 1);
+    run("scroll 1 line", scrollLine, 1);
+    run("scroll 10 lines", scrollTenLines, 1);
+    run("scroll region", scrollRegion, 0);
+    run("redraw", redraw, 1);
+    run("change all", changeEveryCell, 1);
+
+    freeFrameDiff();
+    freeGrid(renderContext.grid);
+    if (failures) {
+        printf("%d frames did not match the records\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""
+Generates src/width.c, the table of codepoint column widths used by getCodepointWidth(), from the Unicode data
+bundled with Python. Run `make width_table` after updating Python to pick up a newer Unicode version.
+"""
+
+import sys
+import unicodedata
+
+CODEPOINTS = 0x110000
+BLOCK_SIZE = 256
+
+# Format characters that are still drawn with a width, following glibc's wcwidth.
+VISIBLE_FORMAT = {0x00AD, 0x0600, 0x0601, 0x0602, 0x0603, 0x0604, 0x0605, 0x06DD, 0x070F, 0x0890, 0x0891, 0x08E2,
+                  0x110BD, 0x110CD}
+
+
+def width(codePoint):
+    if 0xD800 <= codePoint <= 0xDFFF:
+        return 1
+    character = chr(codePoint)
+    category = unicodedata.category(character)
+    if codePoint == 0x200B or 0x1160 <= codePoint <= 0x11FF:
+        return 0
+    if category in ("Mn", "Me") or (category == "Cf" and codePoint not in VISIBLE_FORMAT):
+        return 0
+    if unicodedata.east_asian_width(character) in ("W", "F"):
+        return 2
+    # Unassigned codepoints in the CJK planes are reserved for wide ideographs.
+    if category == "Cn" and (0x20000 <= codePoint <= 0x2FFFD or 0x30000 <= codePoint <= 0x3FFFD):
+        return 2
+    return 1
+
+
+def main():
+    blocks = []
+    blockIndices = {}
+    stage1 = []
+    for start in range(0, CODEPOINTS, BLOCK_SIZE):
+        packed = bytearray(BLOCK_SIZE // 4)
+        for offset in range(BLOCK_SIZE):
+            packed[offset // 4] |= width(start + offset) << (offset % 4 * 2)
+        packed = bytes(packed)
+        if packed not in blockIndices:
+            blockIndices[packed] = len(blocks)
+            blocks.append(packed)
+        stage1.append(blockIndices[packed])
+    assert len(blocks) <= 256
+
+    output = sys.stdout
+    output.write("// Generated by scripts/generate_width_table.py from Unicode %s. Do not edit.\n\n"
+                 % unicodedata.unidata_version)
+    output.write('#include "width.h"\n\n')
+    output.write("const unsigned char WIDTH_BLOCKS[%d] = {\n" % len(stage1))
+    for i in range(0, len(stage1), 24):
+        output.write("    " + ", ".join("%d" % value for value in stage1[i:i + 24]) + ",\n")
+    output.write("};\n\n")
+    output.write("const unsigned char WIDTH_BITS[%d] = {\n" % (len(blocks) * BLOCK_SIZE // 4))
+    for block in blocks:
+        for i in range(0, len(block), 16):
+            output.write("    " + ", ".join("0x%02X" % value for value in block[i:i + 16]) + ",\n")
+    output.write("};\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,247 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BASE64_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#include "base64.h"
+
+#define INVALID_CHARACTER 0xFF
+
+typedef int (*DecodeBlocksFunction)(const unsigned char *input, int length, unsigned char *output, int *written);
+typedef int (*EncodeBlocksFunction)(const unsigned char *input, int length, unsigned char *output, int *written);
+
+static const unsigned char ALPHABET[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static unsigned char decodeTable[256];
+
+static int decodeBlocksScalar(const unsigned char *input, int length, unsigned char *output, int *written);
+static int encodeBlocksScalar(const unsigned char *input, int length, unsigned char *output, int *written);
+static DecodeBlocksFunction decodeBlocks = decodeBlocksScalar;
+static EncodeBlocksFunction encodeBlocks = encodeBlocksScalar;
+
+/**
+ * Decodes complete groups of 4 characters until the input runs out or a group contains padding or an invalid
+ * character. Returns the number of characters consumed, which is always a multiple of 4.
+*/
+static int decodeBlocksScalar(const unsigned char *input, int length, unsigned char *output, int *written) {
+    int i = 0;
+    int o = 0;
+    for (; i + 4 <= length; i += 4) {
+        const unsigned int a = decodeTable[input[i]];
+        const unsigned int b = decodeTable[input[i + 1]];
+        const unsigned int c = decodeTable[input[i + 2]];
+        const unsigned int d = decodeTable[input[i + 3]];
+        if ((a | b | c | d) & 0x80) {
+            break;
+        }
+        const unsigned int bits = (a << 18) | (b << 12) | (c << 6) | d;
+        output[o++] = bits >> 16;
+        output[o++] = bits >> 8;
+        output[o++] = bits;
+    }
+    *written = o;
+    return i;
+}
+
+/**
+ * Encodes complete groups of 3 bytes. Returns the number of bytes consumed.
+*/
+static int encodeBlocksScalar(const unsigned char *input, int length, unsigned char *output, int *written) {
+    int i = 0;
+    int o = 0;
+    for (; i + 3 <= length; i += 3) {
+        const unsigned int bits = (input[i] << 16) | (input[i + 1] << 8) | input[i + 2];
+        output[o++] = ALPHABET[(bits >> 18) & 0x3F];
+        output[o++] = ALPHABET[(bits >> 12) & 0x3F];
+        output[o++] = ALPHABET[(bits >> 6) & 0x3F];
+        output[o++] = ALPHABET[bits & 0x3F];
+    }
+    *written = o;
+    return i;
+}
+
+#ifdef BASE64_SSSE3
+
+/**
+ * Decodes 16 characters into 12 bytes per iteration. Characters are validated and translated to their 6-bit
+ * values with nibble lookups (pshufb), then packed with multiply-adds. The loop stops at the first block holding
+ * anything outside the alphabet, leaving it to the scalar path. Each store writes 16 bytes, so the output needs 4
+ * bytes of slack past the decoded data, see BASE64_DECODED_SIZE.
+*/
+__attribute__((target("ssse3")))
+static int decodeBlocksSSSE3(const unsigned char *input, int length, unsigned char *output, int *written) {
+    const __m128i lutLow = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHigh = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask2F = _mm_set1_epi8(0x2F);
+    const __m128i packShuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    int i = 0;
+    int o = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i characters = _mm_loadu_si128((const __m128i *) (input + i));
+
+        const __m128i highNibbles = _mm_and_si128(_mm_srli_epi32(characters, 4), mask2F);
+        const __m128i lowNibbles = _mm_and_si128(characters, mask2F);
+        const __m128i high = _mm_shuffle_epi8(lutHigh, highNibbles);
+        const __m128i low = _mm_shuffle_epi8(lutLow, lowNibbles);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(low, high), _mm_setzero_si128())) != 0) {
+            break;
+        }
+
+        const __m128i is2F = _mm_cmpeq_epi8(characters, mask2F);
+        const __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(is2F, highNibbles));
+        characters = _mm_add_epi8(characters, roll);
+
+        // Merge pairs of 6-bit values into 12 bits, then pairs of those into 24 bits, and drop the empty bytes.
+        const __m128i merged = _mm_maddubs_epi16(characters, _mm_set1_epi32(0x01400140));
+        const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *) (output + o), _mm_shuffle_epi8(packed, packShuffle));
+        o += 12;
+    }
+    *written = o;
+    return i;
+}
+
+/**
+ * Encodes 12 bytes into 16 characters per iteration. Each iteration loads 16 bytes, so the final 4 input bytes are
+ * always left to the scalar path.
+*/
+__attribute__((target("ssse3")))
+static int encodeBlocksSSSE3(const unsigned char *input, int length, unsigned char *output, int *written) {
+    const __m128i spreadShuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+
+    int i = 0;
+    int o = 0;
+    for (; i + 16 <= length; i += 12) {
+        __m128i bytes = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (input + i)), spreadShuffle);
+
+        // Move each 6-bit value into its own byte.
+        const __m128i t0 = _mm_and_si128(bytes, _mm_set1_epi32(0x0FC0FC00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(bytes, _mm_set1_epi32(0x003F03F0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        const __m128i values = _mm_or_si128(t1, t3);
+
+        // Offset each value into its range of the alphabet.
+        __m128i ranges = _mm_subs_epu8(values, _mm_set1_epi8(51));
+        ranges = _mm_sub_epi8(ranges, _mm_cmpgt_epi8(values, _mm_set1_epi8(25)));
+        _mm_storeu_si128((__m128i *) (output + o), _mm_add_epi8(values, _mm_shuffle_epi8(lut, ranges)));
+        o += 16;
+    }
+    *written = o;
+    return i;
+}
+
+#endif
+
+/**
+ * Builds the decoding table and selects the vectorized block functions when the CPU supports them.
+*/
+void initBase64() {
+    memset(decodeTable, INVALID_CHARACTER, sizeof(decodeTable));
+    for (int i = 0; i < 64; i++) {
+        decodeTable[ALPHABET[i]] = i;
+    }
+
+#ifdef BASE64_SSSE3
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        decodeBlocks = decodeBlocksSSSE3;
+        encodeBlocks = encodeBlocksSSSE3;
+    }
+#endif
+}
+
+void base64DecoderReset(struct Base64Decoder *decoder) {
+    decoder->pendingLength = 0;
+    decoder->invalidCharacters = 0;
+}
+
+/**
+ * Adds a single character to the decoder's pending group, returning the number of bytes written. Padding ends the
+ * current group early, whitespace is skipped and anything else outside the alphabet is counted and skipped.
+*/
+static int decodeCharacter(struct Base64Decoder *decoder, unsigned char c, unsigned char *output) {
+    const unsigned char value = decodeTable[c];
+    if (value == INVALID_CHARACTER) {
+        if (c == '=') {
+            const int length = decoder->pendingLength;
+            const unsigned char *pending = decoder->pending;
+            decoder->pendingLength = 0;
+            if (length == 2) {
+                output[0] = (pending[0] << 2) | (pending[1] >> 4);
+                return 1;
+            } else if (length == 3) {
+                output[0] = (pending[0] << 2) | (pending[1] >> 4);
+                output[1] = (pending[1] << 4) | (pending[2] >> 2);
+                return 2;
+            }
+        } else if (c != '\n' && c != '\r' && c != ' ') {
+            decoder->invalidCharacters++;
+        }
+        return 0;
+    }
+
+    decoder->pending[decoder->pendingLength++] = value;
+    if (decoder->pendingLength < 4) {
+        return 0;
+    }
+
+    const unsigned char *pending = decoder->pending;
+    decoder->pendingLength = 0;
+    output[0] = (pending[0] << 2) | (pending[1] >> 4);
+    output[1] = (pending[1] << 4) | (pending[2] >> 2);
+    output[2] = (pending[2] << 6) | pending[3];
+    return 3;
+}
+
+/**
+ * Decodes the next `length` characters of a base64 stream into `output`, which must hold at least
+ * BASE64_DECODED_SIZE(length) bytes. Returns the number of bytes written. A trailing partial group is kept in the
+ * decoder until the following call.
+*/
+int base64Decode(struct Base64Decoder *decoder, const unsigned char *input, int length, unsigned char *output) {
+    int i = 0;
+    int written = 0;
+    while (i < length) {
+        // Whole groups are decoded in bulk whenever the decoder is at a group boundary.
+        if (decoder->pendingLength == 0) {
+            int blockWritten;
+            i += decodeBlocks(input + i, length - i, output + written, &blockWritten);
+            written += blockWritten;
+            if (i == length) {
+                break;
+            }
+        }
+        written += decodeCharacter(decoder, input[i++], output + written);
+    }
+    return written;
+}
+
+/**
+ * Encodes `length` bytes into `output`, which must hold at least BASE64_ENCODED_SIZE(length) characters. The output
+ * is padded and not null terminated. Returns the number of characters written.
+*/
+int base64Encode(const unsigned char *input, int length, unsigned char *output) {
+    int written;
+    int i = encodeBlocks(input, length, output, &written);
+
+    int blockWritten;
+    i += encodeBlocksScalar(input + i, length - i, output + written, &blockWritten);
+    written += blockWritten;
+
+    const int remaining = length - i;
+    if (remaining > 0) {
+        const unsigned int bits = (input[i] << 16) | (remaining == 2 ? input[i + 1] << 8 : 0);
+        output[written++] = ALPHABET[(bits >> 18) & 0x3F];
+        output[written++] = ALPHABET[(bits >> 12) & 0x3F];
+        output[written++] = remaining == 2 ? ALPHABET[(bits >> 6) & 0x3F] : '=';
+        output[written++] = '=';
+    }
+    return written;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+/**
+ * Incremental base64 decoder state. Characters that do not complete a 4 character group are carried over to the
+ * next call, so input can be decoded in arbitrary chunks.
+*/
+struct Base64Decoder {
+    unsigned char pending[4];
+    int pendingLength;
+    int invalidCharacters;
+};
+
+// Upper bounds on the output size for an input of `length` bytes. The decoded size includes a group carried over
+// from the previous call and 4 bytes of slack for the vectorized decoder's stores.
+#define BASE64_DECODED_SIZE(length) (((length) / 4 + 1) * 3 + 4)
+#define BASE64_ENCODED_SIZE(length) ((((length) + 2) / 3) * 4)
+
+void initBase64();
+void base64DecoderReset(struct Base64Decoder *decoder);
+int base64Decode(struct Base64Decoder *decoder, const unsigned char *input, int length, unsigned char *output);
+int base64Encode(const unsigned char *input, int length, unsigned char *output);
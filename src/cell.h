@@ -0,0 +1,49 @@
+#pragma once
+
+/**
+ * Layout of a packed cell, shared with the text shader through the definitions compileShader() adds to it.
+ *
+ *      bits  0-13  glyph id, see glyph.h
+ *      bit  14     first cell of a double-width character
+ *      bit  15     spacer cell after a double-width character, drawing the right half of its glyph
+ *      bits 16-31  style id, an index into the style table, see style.h
+ *
+ * A blank cell with the default style is 0, so runs of them can be cleared with memset.
+*/
+#define CELL_GLYPH_SHIFT 0
+#define CELL_GLYPH_MASK 0x3FFF
+#define CELL_WIDE (1u << 14)
+#define CELL_SPACER (1u << 15)
+// Glyph and width flags, everything but the style.
+#define CELL_CONTENT_MASK 0xFFFF
+#define CELL_STYLE_SHIFT 16
+#define CELL_STYLE_MASK 0xFFFF
+
+/**
+ * Layout of a style table entry.
+ *
+ *      bits  0-8   foreground palette index
+ *      bits  9-17  background palette index, 0 for the window background
+ *      bits 18-21  attributes
+ *      bits 22-31  hyperlink id, 0 for text that is not part of a link, see hyperlink.h
+*/
+#define STYLE_FOREGROUND_SHIFT 0
+#define STYLE_BACKGROUND_SHIFT 9
+#define STYLE_COLOR_MASK 0x1FF
+#define STYLE_ATTRIBUTE_SHIFT 18
+#define STYLE_ATTRIBUTE_MASK 0xF
+#define STYLE_LINK_SHIFT 22
+#define STYLE_LINK_MASK 0x3FF
+
+static inline unsigned int packStyle(int foreground, int background, int attributes) {
+    return ((unsigned int) foreground << STYLE_FOREGROUND_SHIFT) | ((unsigned int) background << STYLE_BACKGROUND_SHIFT)
+        | ((unsigned int) attributes << STYLE_ATTRIBUTE_SHIFT);
+}
+
+static inline int getStyleLink(unsigned int style) {
+    return (style >> STYLE_LINK_SHIFT) & STYLE_LINK_MASK;
+}
+
+static inline unsigned int packCell(int glyph, int style) {
+    return ((unsigned int) glyph << CELL_GLYPH_SHIFT) | ((unsigned int) style << CELL_STYLE_SHIFT);
+}
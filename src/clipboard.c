@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "terminal.h"
+#include "base64.h"
+#include "clipboard.h"
+
+// Number of encoded characters collected before they are decoded as one chunk.
+#define CLIPBOARD_CHUNK_SIZE 4096
+// Largest decoded clipboard payload that is accepted. Larger payloads are discarded.
+#define CLIPBOARD_MAX_SIZE (64 * 1024 * 1024)
+#define CLIPBOARD_MAX_SELECTION 8
+
+/**
+ * State of the OSC 52 command being received. The base64 payload is decoded in chunks as it arrives, so the
+ * encoded form of a large payload is never held in memory.
+*/
+struct ClipboardTransfer {
+    struct Base64Decoder decoder;
+    unsigned char encoded[CLIPBOARD_CHUNK_SIZE];
+    int encodedLength;
+    unsigned char *data;
+    int length;
+    int capacity;
+    char selection[CLIPBOARD_MAX_SELECTION + 1];
+    // Set when the payload is "?", which asks for the clipboard contents instead of setting them.
+    int query;
+    int truncated;
+};
+
+extern struct RenderContext renderContext;
+
+static struct ClipboardTransfer transfer;
+// Latest clipboard contents set by the shell and a waiting query, both handled by flushClipboard().
+static unsigned char *pendingContents;
+static int queryPending;
+static char querySelection[CLIPBOARD_MAX_SELECTION + 1];
+
+static void decodeChunk() {
+    if (transfer.truncated || transfer.encodedLength == 0) {
+        transfer.encodedLength = 0;
+        return;
+    }
+
+    // Room for the decoded chunk and a null terminator.
+    const int required = transfer.length + BASE64_DECODED_SIZE(transfer.encodedLength) + 1;
+    if (required > CLIPBOARD_MAX_SIZE) {
+        transfer.truncated = 1;
+        transfer.encodedLength = 0;
+        return;
+    }
+    if (required > transfer.capacity) {
+        int capacity = transfer.capacity > 0 ? transfer.capacity : CLIPBOARD_CHUNK_SIZE;
+        while (capacity < required) capacity *= 2;
+        transfer.data = realloc(transfer.data, capacity);
+        transfer.capacity = capacity;
+    }
+
+    transfer.length += base64Decode(&transfer.decoder, transfer.encoded, transfer.encodedLength, transfer.data + transfer.length);
+    transfer.encodedLength = 0;
+}
+
+/**
+ * Writes all of `data` to the shell, waiting for the pseudo-terminal to drain when its buffer is full.
+*/
+static void writeToShell(const unsigned char *data, int length) {
+    while (length > 0) {
+        const int bytesWritten = write(renderContext.controlFd, data, length);
+        if (bytesWritten > 0) {
+            data += bytesWritten;
+            length -= bytesWritten;
+        } else if (bytesWritten == -1 && (errno == EAGAIN || errno == EINTR)) {
+            struct pollfd pollFd = { .fd = renderContext.controlFd, .events = POLLOUT };
+            poll(&pollFd, 1, 100);
+        } else {
+            printf("Failed to write clipboard contents to shell.\n");
+            return;
+        }
+    }
+}
+
+/**
+ * Answers a clipboard query with ESC]52;<selection>;<base64>BEL. Reading the clipboard lets any program running in
+ * the terminal see its contents, so queries are ignored unless allowClipboardRead is set.
+*/
+static void sendClipboardContents() {
+    if (!renderContext.allowClipboardRead) {
+        printf("Ignoring OSC 52 clipboard query, clipboard reads are disabled.\n");
+        return;
+    }
+
+    const char *contents = glfwGetClipboardString(renderContext.window);
+    const int contentsLength = contents ? strlen(contents) : 0;
+    const int selectionLength = strlen(querySelection);
+
+    unsigned char *reply = malloc(BASE64_ENCODED_SIZE(contentsLength) + selectionLength + 8);
+    int length = 0;
+    memcpy(reply, "\x1b]52;", 5);
+    length += 5;
+    memcpy(reply + length, querySelection, selectionLength);
+    length += selectionLength;
+    reply[length++] = ';';
+    length += base64Encode((const unsigned char *) contents, contentsLength, reply + length);
+    reply[length++] = 0x7;
+
+    writeToShell(reply, length);
+    free(reply);
+}
+
+/**
+ * Starts an OSC 52 command for the given selection parameter (such as "c" or "p"). GLFW only exposes a single
+ * clipboard, so the selection is only used to answer queries.
+*/
+void clipboardBegin(const unsigned char *selection, int length) {
+    if (length > CLIPBOARD_MAX_SELECTION) length = CLIPBOARD_MAX_SELECTION;
+    memcpy(transfer.selection, selection, length);
+    transfer.selection[length] = '\0';
+
+    base64DecoderReset(&transfer.decoder);
+    transfer.encodedLength = 0;
+    transfer.length = 0;
+    transfer.query = 0;
+    transfer.truncated = 0;
+}
+
+void clipboardAppend(unsigned char byte) {
+    if (byte == '?' && transfer.length == 0 && transfer.encodedLength == 0) {
+        transfer.query = 1;
+        return;
+    }
+
+    transfer.encoded[transfer.encodedLength++] = byte;
+    if (transfer.encodedLength == CLIPBOARD_CHUNK_SIZE) {
+        decodeChunk();
+    }
+}
+
+/**
+ * Finishes the OSC 52 command. The decoded payload replaces any contents still waiting to be copied to the
+ * clipboard, and queries are answered after the pending contents are applied.
+*/
+void clipboardEnd() {
+    if (transfer.query) {
+        strcpy(querySelection, transfer.selection);
+        queryPending = 1;
+        return;
+    }
+
+    decodeChunk();
+    if (transfer.truncated) {
+        printf("Ignoring OSC 52 clipboard payload larger than %d bytes.\n", CLIPBOARD_MAX_SIZE);
+    } else if (transfer.decoder.invalidCharacters > 0) {
+        printf("Ignoring OSC 52 clipboard payload with %d invalid base64 characters.\n", transfer.decoder.invalidCharacters);
+    } else {
+        if (transfer.capacity == 0) {
+            transfer.data = malloc(1);
+        }
+        transfer.data[transfer.length] = '\0';
+        free(pendingContents);
+        pendingContents = transfer.data;
+        transfer.data = 0;
+    }
+
+    free(transfer.data);
+    transfer.data = 0;
+    transfer.capacity = 0;
+    transfer.length = 0;
+}
+
+void flushClipboard() {
+    if (pendingContents) {
+        glfwSetClipboardString(renderContext.window, (const char *) pendingContents);
+        free(pendingContents);
+        pendingContents = 0;
+    }
+
+    if (queryPending) {
+        queryPending = 0;
+        sendClipboardContents();
+    }
+}
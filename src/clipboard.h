@@ -0,0 +1,6 @@
+#pragma once
+
+void clipboardBegin(const unsigned char *selection, int length);
+void clipboardAppend(unsigned char byte);
+void clipboardEnd();
+void flushClipboard();
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+#include "cluster.h"
+#include "glyph.h"
+
+// Codepoints stored in the arena before the first compaction.
+#define CLUSTER_ARENA_INITIAL 4096
+
+extern struct RenderContext renderContext;
+
+/**
+ * A cluster's codepoints are arena[offset, offset + length). Free ids have a length of 0.
+*/
+struct Cluster {
+    int offset;
+    int length;
+};
+
+static int *arena;
+static int arenaSize = 0;
+static int arenaCapacity = 0;
+static struct Cluster *clusters;
+static int clusterCapacity = 0;
+// Ids that were never used start at nextId, ids freed by compactClusters() are kept in freeIds.
+static int nextId = 0;
+static int *freeIds;
+static int freeCount = 0;
+// Unused clusters are dropped at the next frame once the arena holds this many codepoints.
+static int compactAt = CLUSTER_ARENA_INITIAL;
+// Open addressing table of cluster ids, -1 marks an empty slot. Kept at most half full.
+static int *clusterTable;
+static int tableSize = 0;
+static int clusterCount = 0;
+
+static unsigned int hashCodePoints(const int *codePoints, int length) {
+    unsigned int hash = 0x811c9dc5;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned int) codePoints[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+static void insertCluster(int id) {
+    const struct Cluster *cluster = &clusters[id];
+    unsigned int slot = hashCodePoints(&arena[cluster->offset], cluster->length) & (tableSize - 1);
+    while (clusterTable[slot] != -1) {
+        slot = (slot + 1) & (tableSize - 1);
+    }
+    clusterTable[slot] = id;
+}
+
+static void rebuildTable(int size) {
+    free(clusterTable);
+    tableSize = size;
+    clusterTable = malloc(tableSize * sizeof(int));
+    memset(clusterTable, -1, tableSize * sizeof(int));
+    for (int id = 0; id < nextId; id++) {
+        if (clusters[id].length > 0) {
+            insertCluster(id);
+        }
+    }
+}
+
+/**
+ * Returns the id of a cluster, adding it to the arena the first time it is seen.
+*/
+int internCluster(const int *codePoints, int length) {
+    if (tableSize == 0) {
+        rebuildTable(256);
+    }
+
+    unsigned int slot = hashCodePoints(codePoints, length) & (tableSize - 1);
+    while (clusterTable[slot] != -1) {
+        const struct Cluster *cluster = &clusters[clusterTable[slot]];
+        if (cluster->length == length && memcmp(&arena[cluster->offset], codePoints, length * sizeof(int)) == 0) {
+            return clusterTable[slot];
+        }
+        slot = (slot + 1) & (tableSize - 1);
+    }
+
+    if (arenaSize + length > arenaCapacity) {
+        arenaCapacity = arenaCapacity ? arenaCapacity * 2 : CLUSTER_ARENA_INITIAL;
+        arena = realloc(arena, arenaCapacity * sizeof(int));
+    }
+    int id;
+    if (freeCount > 0) {
+        id = freeIds[--freeCount];
+    } else {
+        if (nextId == clusterCapacity) {
+            clusterCapacity = clusterCapacity ? clusterCapacity * 2 : 256;
+            clusters = realloc(clusters, clusterCapacity * sizeof(struct Cluster));
+            freeIds = realloc(freeIds, clusterCapacity * sizeof(int));
+        }
+        id = nextId++;
+    }
+
+    memcpy(&arena[arenaSize], codePoints, length * sizeof(int));
+    clusters[id] = (struct Cluster) { .offset = arenaSize, .length = length };
+    arenaSize += length;
+    clusterTable[slot] = id;
+    clusterCount++;
+    if (clusterCount * 2 > tableSize) {
+        rebuildTable(tableSize * 2);
+    }
+    return id;
+}
+
+/**
+ * Returns the glyph key of the glyph `key` with one more combining character. Keys of single characters become
+ * clusters, and clusters are extended by interning a copy with the new codepoint appended.
+*/
+int addToCluster(int key, int codePoint) {
+    int codePoints[CLUSTER_MAX_LENGTH];
+    int length = 1;
+    codePoints[0] = key & GLYPH_CODEPOINT_MASK;
+    if (key & GLYPH_CLUSTER) {
+        const int *existing;
+        length = getClusterCodePoints(key & GLYPH_CODEPOINT_MASK, &existing);
+        memcpy(codePoints, existing, length * sizeof(int));
+    }
+    if (length == CLUSTER_MAX_LENGTH) {
+        return key;
+    }
+
+    codePoints[length++] = codePoint;
+    return GLYPH_CLUSTER | internCluster(codePoints, length);
+}
+
+/**
+ * Points `codePoints` at the codepoints of a cluster and returns how many there are. The pointer is valid until
+ * the next cluster is added.
+*/
+int getClusterCodePoints(int id, const int **codePoints) {
+    *codePoints = &arena[clusters[id].offset];
+    return clusters[id].length;
+}
+
+/**
+ * Drops the clusters no cell of the grid shows and packs the codepoints of the rest to the start of the arena.
+ * Cells refer to clusters only through the keys of their glyph ids, and the history stores the codepoints of
+ * clusters in its rows, so clusters of rows that scrolled out are dropped once the grid no longer holds them. Runs
+ * once per frame, and only does work once the arena has filled up since the last compaction.
+*/
+void compactClusters() {
+    if (arenaSize < compactAt) {
+        return;
+    }
+
+    unsigned char *used = calloc(nextId, 1);
+    const struct CellGrid *grid = renderContext.grid;
+    for (int row = 0; grid && row < grid->rows; row++) {
+        const unsigned int *cells = &grid->cells[row * grid->columns];
+        for (int x = 0; x < grid->blankFrom[row]; x++) {
+            const unsigned int key = getGlyphKey((cells[x] >> CELL_GLYPH_SHIFT) & CELL_GLYPH_MASK);
+            if (key & GLYPH_CLUSTER) {
+                used[key & GLYPH_CODEPOINT_MASK] = 1;
+            }
+        }
+    }
+
+    int *packed = malloc(arenaCapacity * sizeof(int));
+    int packedSize = 0;
+    freeCount = 0;
+    clusterCount = 0;
+    for (int id = 0; id < nextId; id++) {
+        struct Cluster *cluster = &clusters[id];
+        if (cluster->length > 0 && used[id]) {
+            memcpy(&packed[packedSize], &arena[cluster->offset], cluster->length * sizeof(int));
+            cluster->offset = packedSize;
+            packedSize += cluster->length;
+            clusterCount++;
+            continue;
+        }
+        if (cluster->length > 0) {
+            forgetGlyph(GLYPH_CLUSTER | id);
+            forgetGlyph(GLYPH_CLUSTER | GLYPH_LEFT_HALF | id);
+            forgetGlyph(GLYPH_CLUSTER | GLYPH_RIGHT_HALF | id);
+            cluster->length = 0;
+        }
+        freeIds[freeCount++] = id;
+    }
+    free(used);
+    free(arena);
+    arena = packed;
+    arenaSize = packedSize;
+    rebuildTable(tableSize);
+
+    // Compact again once the arena has grown by as much as it holds now.
+    compactAt = arenaSize * 2 > CLUSTER_ARENA_INITIAL ? arenaSize * 2 : CLUSTER_ARENA_INITIAL;
+}
+
+void freeClusters() {
+    free(arena);
+    free(clusters);
+    free(freeIds);
+    free(clusterTable);
+    arena = 0;
+    clusters = 0;
+    freeIds = 0;
+    clusterTable = 0;
+    arenaSize = arenaCapacity = clusterCapacity = tableSize = 0;
+    nextId = freeCount = clusterCount = 0;
+    compactAt = CLUSTER_ARENA_INITIAL;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+/**
+ * Grapheme clusters: a base character followed by the combining characters drawn over it in the same cell. The
+ * codepoints of each distinct cluster are interned in an arena, and a cell shows a cluster through the glyph key
+ * GLYPH_CLUSTER | id, so cells stay the same size and cells without combining characters are untouched.
+*/
+// Longest cluster kept, further combining characters are dropped.
+#define CLUSTER_MAX_LENGTH 32
+
+int internCluster(const int *codePoints, int length);
+int addToCluster(int key, int codePoint);
+int getClusterCodePoints(int id, const int **codePoints);
+void compactClusters();
+void freeClusters();
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+#include "colors.h"
+#include "style.h"
+
+#define TRUECOLOR_TABLE_SIZE 1024
+// Palette entries of 24-bit colors taken before unused ones are collected at the next frame, see collectStyles().
+#define TRUECOLOR_COLLECT_COUNT ((PALETTE_SIZE - PALETTE_TRUECOLOR_BASE) * 3 / 4)
+
+// Normal brightness colors, used by SGR 30-37 and 40-47.
+static const int COLORS_NORMAL[] = {
+    0x00282C34, // black
+    0x00E06C75, // red
+    0x0098C379, // green
+    0x00E5C07B, // yellow
+    0x0061AFEF, // blue
+    0x00C678DD, // magenta
+    0x0056B6C2, // cyan
+    0x00DCDFE4  // white
+};
+
+// Bright colors, used by SGR 90-97 and 100-107.
+static const int COLORS_BRIGHT[] = {
+    0x005A6374, // bright black
+    0x00E06C75, // bright red
+    0x0098C379, // bright green
+    0x00E5C07B, // bright yellow
+    0x0061AFEF, // bright blue
+    0x00C678DD, // bright magenta
+    0x0056B6C2, // bright cyan
+    0x00DCDFE4  // bright white
+};
+
+// Channel values of the 6x6x6 color cube in the xterm 256 color palette.
+static const int CUBE_LEVELS[] = { 0x00, 0x5F, 0x87, 0xAF, 0xD7, 0xFF };
+
+extern struct RenderContext renderContext;
+
+static int palette[PALETTE_SIZE];
+// Entries for 24-bit colors that were never used start at nextTrueColor, entries freed by collectTrueColors() are
+// kept in freeTrueColors.
+static int nextTrueColor = PALETTE_TRUECOLOR_BASE;
+static unsigned short freeTrueColors[PALETTE_SIZE - PALETTE_TRUECOLOR_BASE];
+static int freeTrueColorCount = 0;
+// Open addressing table of palette indices for interned 24-bit colors. 0 marks an empty slot.
+static unsigned short trueColorTable[TRUECOLOR_TABLE_SIZE];
+// Range of palette entries that changed since the palette was last written to each shader context slot.
+static int dirtyStart[SHADER_CONTEXT_SLOTS];
+static int dirtyEnd[SHADER_CONTEXT_SLOTS];
+
+static void markPaletteDirty(int index) {
+    for (int slot = 0; slot < SHADER_CONTEXT_SLOTS; slot++) {
+        if (dirtyStart[slot] == dirtyEnd[slot]) {
+            dirtyStart[slot] = index;
+            dirtyEnd[slot] = index + 1;
+        } else {
+            if (index < dirtyStart[slot]) dirtyStart[slot] = index;
+            if (index >= dirtyEnd[slot]) dirtyEnd[slot] = index + 1;
+        }
+    }
+}
+
+void initPalette() {
+    palette[PALETTE_DEFAULT] = DEFAULT_FOREGROUND_COLOR;
+
+    for (int i = 0; i < 8; i++) {
+        palette[PALETTE_XTERM_BASE + i] = COLORS_NORMAL[i];
+        palette[PALETTE_XTERM_BASE + 8 + i] = COLORS_BRIGHT[i];
+    }
+
+    for (int i = 0; i < 216; i++) {
+        const int r = CUBE_LEVELS[i / 36], g = CUBE_LEVELS[(i / 6) % 6], b = CUBE_LEVELS[i % 6];
+        palette[PALETTE_XTERM_BASE + 16 + i] = (r << 16) | (g << 8) | b;
+    }
+
+    for (int i = 0; i < 24; i++) {
+        const int level = 8 + i * 10;
+        palette[PALETTE_XTERM_BASE + 232 + i] = (level << 16) | (level << 8) | level;
+    }
+
+    invalidateShaderPalette();
+}
+
+/**
+ * Marks every palette entry in use as changed, so that the whole palette is written to each slot of a new shader
+ * context.
+*/
+void invalidateShaderPalette() {
+    for (int slot = 0; slot < SHADER_CONTEXT_SLOTS; slot++) {
+        dirtyStart[slot] = 0;
+        dirtyEnd[slot] = nextTrueColor;
+    }
+}
+
+static int nearestCubeLevel(int value) {
+    int nearest = 0;
+    for (int i = 1; i < 6; i++) {
+        if (abs(CUBE_LEVELS[i] - value) < abs(CUBE_LEVELS[nearest] - value)) {
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+/**
+ * Returns the index of the closest color in the xterm 256 color cube or grayscale ramp.
+*/
+static int getNearestXtermIndex(int r, int g, int b) {
+    const int ri = nearestCubeLevel(r), gi = nearestCubeLevel(g), bi = nearestCubeLevel(b);
+    const int dr = CUBE_LEVELS[ri] - r, dg = CUBE_LEVELS[gi] - g, db = CUBE_LEVELS[bi] - b;
+    const int cubeDistance = dr * dr + dg * dg + db * db;
+
+    int grayIndex = ((r + g + b) / 3 - 8 + 5) / 10;
+    if (grayIndex < 0) grayIndex = 0;
+    if (grayIndex > 23) grayIndex = 23;
+    const int level = 8 + grayIndex * 10;
+    const int grayDistance = (level - r) * (level - r) + (level - g) * (level - g) + (level - b) * (level - b);
+
+    if (grayDistance < cubeDistance) {
+        return PALETTE_XTERM_BASE + 232 + grayIndex;
+    }
+    return PALETTE_XTERM_BASE + 16 + ri * 36 + gi * 6 + bi;
+}
+
+static unsigned int hashTrueColor(int color) {
+    return ((unsigned int) color * 0x9E3779B1u) >> 22;
+}
+
+/**
+ * Returns a palette index for a 24-bit color, adding the color to the palette the first time it is seen. Unused
+ * colors are collected at the next frame once most entries are taken, and should the palette fill up before then,
+ * new colors use the nearest xterm 256 color.
+*/
+int getTrueColorIndex(int r, int g, int b) {
+    r &= 0xFF;
+    g &= 0xFF;
+    b &= 0xFF;
+    const int color = (r << 16) | (g << 8) | b;
+
+    unsigned int slot = hashTrueColor(color);
+    while (trueColorTable[slot] != 0) {
+        if (palette[trueColorTable[slot]] == color) {
+            return trueColorTable[slot];
+        }
+        slot = (slot + 1) % TRUECOLOR_TABLE_SIZE;
+    }
+
+    int index;
+    if (freeTrueColorCount > 0) {
+        index = freeTrueColors[--freeTrueColorCount];
+    } else if (nextTrueColor < PALETTE_SIZE) {
+        index = nextTrueColor++;
+    } else {
+        return getNearestXtermIndex(r, g, b);
+    }
+
+    palette[index] = color;
+    trueColorTable[slot] = index;
+    markPaletteDirty(index);
+    if (nextTrueColor - PALETTE_TRUECOLOR_BASE - freeTrueColorCount >= TRUECOLOR_COLLECT_COUNT) {
+        collectStylesSoon();
+    }
+    return index;
+}
+
+/**
+ * Returns the 24-bit color of a palette entry.
+*/
+int getPaletteColor(int index) {
+    return palette[index];
+}
+
+/**
+ * Frees the 24-bit colors whose palette entry is not set in `used`, which is indexed by palette index. Called by
+ * collectStyles(), since styles are the only references to the entries apart from the current colors.
+*/
+void collectTrueColors(const unsigned char *used) {
+    memset(trueColorTable, 0, sizeof(trueColorTable));
+    freeTrueColorCount = 0;
+    for (int index = PALETTE_TRUECOLOR_BASE; index < nextTrueColor; index++) {
+        if (!used[index]) {
+            freeTrueColors[freeTrueColorCount++] = index;
+            continue;
+        }
+        unsigned int slot = hashTrueColor(palette[index]);
+        while (trueColorTable[slot] != 0) {
+            slot = (slot + 1) % TRUECOLOR_TABLE_SIZE;
+        }
+        trueColorTable[slot] = index;
+    }
+}
+
+/**
+ * Writes palette entries added since the current shader context slot was last written.
+*/
+void updateShaderPalette() {
+    const int slot = renderContext.shaderContextSlot;
+    for (int i = dirtyStart[slot]; i < dirtyEnd[slot]; i++) {
+        renderContext.shaderContext->palette[i] = palette[i];
+    }
+    dirtyStart[slot] = dirtyEnd[slot] = 0;
+}
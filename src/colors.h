@@ -1,49 +1,20 @@
 #pragma once
 
-// Normal brightness foreground colors.
-const int COLORS_FG[] = {
-    0x00282C34, // 30, black
-    0x00E06C75, // 31, red
-    0x0098C379, // 32, green
-    0x00E5C07B, // 33, yellow
-    0x0061AFEF, // 34, blue
-    0x00C678DD, // 35, magenta
-    0x0056B6C2, // 36, cyan
-    0x00DCDFE4  // 37, white
-};
+/**
+ * Cells store foreground and background colors as indices into a palette that is shared with the text shader.
+ * Index 0 is the default color, xterm's 256 colors follow, and the remaining entries hold 24-bit colors that are
+ * interned as they are used. Entries of 24-bit colors that no style refers to anymore are reused.
+*/
+#define PALETTE_DEFAULT 0
+#define PALETTE_XTERM_BASE 1
+#define PALETTE_TRUECOLOR_BASE 257
+#define PALETTE_SIZE 512
 
-// Normal brightness background colors.
-const int COLORS_BG[] = {
-    0x00282C34, // 40, black
-    0x00E06C75, // 41, red
-    0x0098C379, // 42, green
-    0x00E5C07B, // 43, yellow
-    0x0061AFEF, // 44, blue
-    0x00C678DD, // 45, magenta
-    0x0056B6C2, // 46, cyan
-    0x00DCDFE4  // 47, white
-};
+static const int DEFAULT_FOREGROUND_COLOR = 0x00DCDFE4;
 
-// Bright foreground colors.
-const int COLORS_FG_BRIGHT[] = {
-    0x005A6374, // 90, bright black
-    0x00E06C75, // 91, bright red
-    0x0098C379, // 92, bright green
-    0x00E5C07B, // 93, bright yellow
-    0x0061AFEF, // 94, bright blue
-    0x00C678DD, // 95, bright magenta
-    0x0056B6C2, // 96, bright cyan
-    0x00DCDFE4  // 97, bright white
-};
-
-// Bright background colors.
-const int COLORS_BG_BRIGHT[] = {
-    0x005A6374, // 100, bright black
-    0x00E06C75, // 101, bright red
-    0x0098C379, // 102, bright green
-    0x00E5C07B, // 103, bright yellow
-    0x0061AFEF, // 104, bright blue
-    0x00C678DD, // 105, bright magenta
-    0x0056B6C2, // 106, bright cyan
-    0x00DCDFE4  // 107, bright white
-};
+void initPalette();
+void invalidateShaderPalette();
+int getTrueColorIndex(int r, int g, int b);
+int getPaletteColor(int index);
+void collectTrueColors(const unsigned char *used);
+void updateShaderPalette();
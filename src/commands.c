@@ -3,8 +3,13 @@
 #include <string.h>
 
 #include "terminal.h"
+#include "clipboard.h"
 #include "colors.h"
 #include "commands.h"
+#include "effects.h"
+#include "hyperlink.h"
+#include "screen.h"
+#include "stats.h"
 
 enum Stage {
     STAGE_PLAIN_TEXT,
@@ -23,6 +28,8 @@ enum SequenceType {
 enum CommandState {
     COMMAND_NONE,
     COMMAND_OSC_WINDOW_TITLE,
+    COMMAND_OSC_CLIPBOARD,
+    COMMAND_OSC_HYPERLINK,
     COMMAND_OSC_NOT_SUPPORTED
 };
 
@@ -45,12 +52,74 @@ struct ParsingState {
     enum SequenceType sequenceType;
     enum CommandState commandState;
     enum ColorInputState colorInput;
+    // Color updated by an extended color argument, and the components of a 24-bit color read so far.
+    int *colorTarget;
+    int colorComponents[3];
+    int colorComponentIndex;
+    // Set after an ESC inside an OSC command, which is either the first byte of ST (ESC\) or aborts the command.
+    int oscEscape;
     struct Buffer argBuffer;
     int characterBuffer;
     int characterByteIndex;
     int bytesInCharacter;
 };
 
+#define CSI_FINAL_FIRST 0x40
+#define CSI_FINAL_LAST 0x7E
+// No private marker, followed by the markers '<', '=', '>' and '?'.
+#define CSI_MARKER_COUNT 5
+#define MAX_CSI_ARGUMENTS 20
+
+struct CSIArguments {
+    int count;
+    int values[MAX_CSI_ARGUMENTS];
+    // Set for values separated from the one before by ':' instead of ';', which are sub-parameters of it.
+    u8 subParameter[MAX_CSI_ARGUMENTS];
+    int defaultValue;
+    u8 privateMarker;
+    u8 intermediate;
+};
+
+typedef void (*CSIHandler)(struct CSIArguments *args);
+
+struct CSISequence {
+    CSIHandler handler;
+    int defaultValue;
+    u8 intermediate;
+    u8 cancelsWrap;
+};
+
+/**
+ * Every supported CSI sequence, described once. Each entry is the final byte, private marker (or 0), intermediate
+ * byte (or 0), the value of omitted arguments, whether it cancels a pending wrap, and the handler. Arguments are
+ * parsed the same way for every sequence, so adding an entry here is enough to support a new sequence. Sequences
+ * that move the cursor or edit the screen around it cancel a pending wrap, while modes and attributes leave it.
+*/
+#define CSI_SEQUENCES(X) \
+    X('@', 0, 0, 1, 1, csiInsertCharacters) \
+    X('A', 0, 0, 1, 1, csiCursorUp) \
+    X('B', 0, 0, 1, 1, csiCursorDown) \
+    X('C', 0, 0, 1, 1, csiCursorForward) \
+    X('D', 0, 0, 1, 1, csiCursorBack) \
+    X('E', 0, 0, 1, 1, csiCursorNextLine) \
+    X('F', 0, 0, 1, 1, csiCursorPreviousLine) \
+    X('G', 0, 0, 1, 1, csiCursorHorizontalAbsolute) \
+    X('H', 0, 0, 1, 1, csiCursorPosition) \
+    X('J', 0, 0, 0, 1, csiEraseInDisplay) \
+    X('K', 0, 0, 0, 1, csiEraseInLine) \
+    X('L', 0, 0, 1, 1, csiInsertLines) \
+    X('M', 0, 0, 1, 1, csiDeleteLines) \
+    X('P', 0, 0, 1, 1, csiDeleteCharacters) \
+    X('S', 0, 0, 1, 1, csiScrollUp) \
+    X('T', 0, 0, 1, 1, csiScrollDown) \
+    X('X', 0, 0, 1, 1, csiEraseCharacters) \
+    X('b', 0, 0, 1, 0, csiRepeatCharacter) \
+    X('f', 0, 0, 1, 1, csiCursorPosition) \
+    X('h', '?', 0, 0, 0, csiSetPrivateMode) \
+    X('l', '?', 0, 0, 0, csiResetPrivateMode) \
+    X('m', 0, 0, 0, 0, csiGraphicsControl) \
+    X('r', 0, 0, 1, 1, csiSetScrollRegion)
+
 extern struct RenderContext renderContext;
 
 static struct ParsingState state = {
@@ -70,10 +139,18 @@ static struct ParsingState state = {
 static int handleStagePlainText(u8 byte, int *character);
 static int handleStageEscape(u8 byte, int *character);
 static int handleStageArguments(u8 byte, int *character);
+static int handleStageOSC(u8 byte, int *character);
 static int executeCommandArgument();
 static void executeC0ControlCode(u8 byte);
 
+#define CSI_HANDLER_DECLARATION(finalByte, marker, intermediate, defaultValue, cancelsWrap, handler) \
+    static void handler(struct CSIArguments *args);
+CSI_SEQUENCES(CSI_HANDLER_DECLARATION)
+
 int processTextByte(u8 byte, int *character) {
+    STATS_BYTE(state.currentStage != STAGE_PLAIN_TEXT || byte == 0x1B ? STATS_BYTES_SEQUENCE :
+        (byte < 0x20 || byte == 0x7F) ? STATS_BYTES_CONTROL : STATS_BYTES_TEXT);
+
     switch (state.currentStage) {
         case STAGE_PLAIN_TEXT:  return handleStagePlainText(byte, character);
         case STAGE_ESCAPE:      return handleStageEscape(byte, character);
@@ -83,6 +160,129 @@ int processTextByte(u8 byte, int *character) {
     }
 }
 
+/**
+ * Returns the length of the longest prefix of `data` holding only printable ASCII, carriage returns, line feeds and
+ * complete SGR sequences, which change nothing but the text and the current style, and sets `*lineFeeds` to the
+ * number of line feeds in it.
+*/
+static int scanPlainLines(const u8 *data, int length, int *lineFeeds) {
+    int count = 0;
+    int i = 0;
+    while (i < length) {
+        const u8 byte = data[i];
+        if ((byte >= 0x20 && byte < 0x7F) || byte == 0xD) {
+            i++;
+            continue;
+        }
+        if (byte == 0xA) {
+            count++;
+            i++;
+            continue;
+        }
+        if (byte == 0x1B && i + 1 < length && data[i + 1] == '[') {
+            int end = i + 2;
+            while (end < length && ((data[end] >= '0' && data[end] <= '9') || data[end] == ';' || data[end] == ':')) end++;
+            if (end < length && data[end] == 'm') {
+                i = end + 1;
+                continue;
+            }
+        }
+        break;
+    }
+    *lineFeeds = count;
+    return i;
+}
+
+static int countLineFeeds(const u8 *data, int length) {
+    int count = 0;
+    for (const u8 *end = data + length; (data = memchr(data, 0xA, end - data)); data++) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Processes the first `lines` lines of `data`, which were found by scanPlainLines(), without writing them to the
+ * screen: they go straight to the history, see beginSkippedRows(). Returns the number of bytes processed, or 0
+ * when lines cannot be skipped at the cursor.
+*/
+static int skipLines(const u8 *data, int lines) {
+    if (!beginSkippedRows()) {
+        return 0;
+    }
+
+    int i = 0;
+    while (lines > 0) {
+        const u8 byte = data[i];
+        if (byte == 0xA || byte == 0xD) {
+            STATS_BYTE(STATS_BYTES_CONTROL);
+            STATS_C0(byte);
+            if (byte == 0xA) {
+                skippedLineFeed();
+                lines--;
+            } else {
+                skippedCarriageReturn();
+            }
+            i++;
+        } else if (byte == 0x1B) {
+            // SGR sequences go through the parser, which only changes the current style.
+            int character;
+            do {
+                processTextByte(data[i++], &character);
+            } while (state.currentStage != STAGE_PLAIN_TEXT);
+        } else {
+            int run = 1;
+            while (data[i + run] >= 0x20 && data[i + run] < 0x7F) run++;
+            STATS_BYTES(STATS_BYTES_TEXT, run);
+            printSkippedText(data + i, run);
+            i += run;
+        }
+    }
+    endSkippedRows();
+    return i;
+}
+
+/**
+ * Processes a buffer of shell output. When the output goes on to scroll by more rows than the ring of the primary
+ * screen holds, the lines it scrolls out of the ring are moved straight to the history instead of being written to
+ * the screen, since they would never be displayed. Line feeds are counted ahead only through plain text and SGR
+ * sequences, where each one is known to scroll once the cursor is at the bottom of the screen.
+*/
+void processText(const u8 *data, int length) {
+    // Bytes [scanStart, scanEnd) were found by scanPlainLines() and contain `lineFeeds` line feeds.
+    int scanStart = 0;
+    int scanEnd = 0;
+    int lineFeeds = 0;
+
+    for (int i = 0; i < length;) {
+        if ((i == 0 || data[i - 1] == 0xA) && state.currentStage == STAGE_PLAIN_TEXT && state.characterByteIndex == 0) {
+            if (i >= scanEnd) {
+                scanEnd = i + scanPlainLines(data + i, length - i, &lineFeeds);
+            } else {
+                lineFeeds -= countLineFeeds(data + scanStart, i - scanStart);
+            }
+            scanStart = i;
+
+            // A row at the bottom of the screen moves to the history on the scroll that brings the ring back to it.
+            const int skipped = lineFeeds - renderContext.primaryScreen.rowCount + 1;
+            if (skipped > 0) {
+                const int processed = skipLines(data + i, skipped);
+                if (processed > 0) {
+                    i += processed;
+                    lineFeeds -= skipped;
+                    scanStart = i;
+                    continue;
+                }
+            }
+        }
+
+        int character;
+        if (processTextByte(data[i++], &character)) {
+            printCharacter(character);
+        }
+    }
+}
+
 static int utf8EncodingToCodepoint(unsigned int encoding) {
     // 1 byte encoding
     if ((encoding >> 7) == 0) {
@@ -180,6 +380,8 @@ static int handleStageEscape(u8 byte, int *character) {
         case 0x5D:
             state.currentStage = STAGE_ARGUMENTS;
             state.sequenceType = SEQUENCE_TYPE_OSC;
+            state.commandState = COMMAND_NONE;
+            state.oscEscape = 0;
             clearBuffer(&state.argBuffer);
             return 0;
         default:
@@ -190,6 +392,14 @@ static int handleStageEscape(u8 byte, int *character) {
 }
 
 static int handleStageArguments(u8 byte, int *character) {
+    if (state.sequenceType == SEQUENCE_TYPE_OSC) {
+        return handleStageOSC(byte, character);
+    }
+
+    // Overlong sequences keep overwriting the last byte of the buffer, so the final byte still ends the sequence.
+    if (state.argBuffer.position == state.argBuffer.length - 1) {
+        state.argBuffer.position--;
+    }
     state.argBuffer.data[state.argBuffer.position] = byte;
     state.argBuffer.position++;
     int endOfCommand = executeCommandArgument();
@@ -203,67 +413,394 @@ static int handleStageArguments(u8 byte, int *character) {
 }
 
 static void executeC0ControlCode(u8 byte) {
+    STATS_C0(byte);
+
     switch (byte) {
         case 0x7: // Bell sound
-            printf("~bell sound~\n");
+            requestBell();
             break;
         case 0x8: // Backspace
+            renderContext.wrapPending = 0;
             if (renderContext.cursorPosition.x > 0) {
                 renderContext.cursorPosition.x -= 1;
             }
             break;
         case 0x9: // Tab
+            renderContext.wrapPending = 0;
             renderContext.cursorPosition.x = renderContext.cursorPosition.x - (renderContext.cursorPosition.x % 8) + 8;
+            if (renderContext.cursorPosition.x > renderContext.screenTileSize.x - 1) {
+                renderContext.cursorPosition.x = renderContext.screenTileSize.x - 1;
+            }
             break;
         case 0xA: // Line feed
-            renderContext.cursorPosition.x = 0;
-            renderContext.cursorPosition.y += 1;
-
-            // If cursor position has passed the bottom row, cursor remains at the last row and the
-            // row offset is incremented.
-            if (renderContext.cursorPosition.y >= renderContext.screenTileSize.y) {
-                renderContext.cursorPosition.y = renderContext.screenTileSize.y - 1;
-                renderContext.glyphIndicesRowOffset = (renderContext.glyphIndicesRowOffset + 1) % MAX_ROWS;
-            }
+            lineFeed();
             break;
         case 0xD: // Carriage return
+            renderContext.wrapPending = 0;
             renderContext.cursorPosition.x = 0;
             break;
     }
 }
 
+/**
+ * Applies a single SGR argument. Extended colors span several arguments (38;5;n and 38;2;r;g;b, or 48 for the
+ * background), so state.colorInput tracks which part of an extended color the next argument provides.
+*/
 static void updateGraphicsState(int command, int index) {
-    // TODO: handle state.colorInput = COLOR_INPUT_8Bit, COLOR_INPUT_24Bit, etc
+    switch (state.colorInput) {
+        case COLOR_INPUT_FG:
+        case COLOR_INPUT_BG:
+            if (command == 5) {
+                state.colorInput = COLOR_INPUT_8Bit;
+            } else if (command == 2) {
+                state.colorInput = COLOR_INPUT_24Bit;
+                state.colorComponentIndex = 0;
+            } else {
+                printf("unhandled extended color mode: %d (index=%d)\n", command, index);
+                state.colorInput = COLOR_INPUT_NONE;
+            }
+            return;
+        case COLOR_INPUT_8Bit:
+            *state.colorTarget = PALETTE_XTERM_BASE + (command & 0xFF);
+            state.colorInput = COLOR_INPUT_NONE;
+            return;
+        case COLOR_INPUT_24Bit:
+            state.colorComponents[state.colorComponentIndex++] = command;
+            if (state.colorComponentIndex == 3) {
+                *state.colorTarget = getTrueColorIndex(state.colorComponents[0], state.colorComponents[1], state.colorComponents[2]);
+                state.colorInput = COLOR_INPUT_NONE;
+            }
+            return;
+        default:
+            break;
+    }
+
+    STATS_SGR(command);
 
     if (command == 0) {
-        renderContext.foregroundColor = COLORS_FG[7];
-        renderContext.backgroundColor = COLORS_BG[7];
-    } else if (command == 38 && index == 0) {
+        renderContext.foregroundColor = PALETTE_DEFAULT;
+        renderContext.backgroundColor = PALETTE_DEFAULT;
+    } else if (command == 38) {
         state.colorInput = COLOR_INPUT_FG;
-    } else if (command == 48 && index == 0) {
+        state.colorTarget = &renderContext.foregroundColor;
+    } else if (command == 48) {
         state.colorInput = COLOR_INPUT_BG;
+        state.colorTarget = &renderContext.backgroundColor;
+    } else if (command == 39) {
+        renderContext.foregroundColor = PALETTE_DEFAULT;
+    } else if (command == 49) {
+        renderContext.backgroundColor = PALETTE_DEFAULT;
     } else if (command >= 30 && command <= 37) {
-        renderContext.foregroundColor = COLORS_FG[command - 30];
+        renderContext.foregroundColor = PALETTE_XTERM_BASE + command - 30;
     } else if (command >= 40 && command <= 47) {
-        renderContext.backgroundColor = COLORS_BG[command - 40];
+        renderContext.backgroundColor = PALETTE_XTERM_BASE + command - 40;
     } else if (command >= 90 && command <= 97) {
-        renderContext.foregroundColor = COLORS_FG_BRIGHT[command - 90];
+        renderContext.foregroundColor = PALETTE_XTERM_BASE + 8 + command - 90;
     } else if (command >= 100 && command <= 107) {
-        renderContext.backgroundColor = COLORS_BG_BRIGHT[command - 100];
+        renderContext.backgroundColor = PALETTE_XTERM_BASE + 8 + command - 100;
     } else {
         // other graphics command
         printf("unhandled graphics command: %d (index=%d)\n", command, index);
     }
+}
+
+/**
+ * Returns the CSI argument at `index`, or the sequence's default value if the argument was omitted. Sequences
+ * whose default is 1 describe counts or positions, where an explicit 0 is also treated as the default.
+*/
+static int csiArgument(struct CSIArguments *args, int index) {
+    if (index >= args->count || args->values[index] < 0) {
+        return args->defaultValue;
+    }
+    if (args->values[index] == 0 && args->defaultValue == 1) {
+        return 1;
+    }
+    return args->values[index];
+}
+
+static void csiCursorUp(struct CSIArguments *args) {
+    renderContext.cursorPosition.y -= csiArgument(args, 0);
+    if (renderContext.cursorPosition.y < 0) {
+        renderContext.cursorPosition.y = 0;
+    }
+}
+
+static void csiCursorDown(struct CSIArguments *args) {
+    renderContext.cursorPosition.y += csiArgument(args, 0);
+    if (renderContext.cursorPosition.y > renderContext.screenTileSize.y - 1) {
+        renderContext.cursorPosition.y = renderContext.screenTileSize.y - 1;
+    }
+}
+
+static void csiCursorForward(struct CSIArguments *args) {
+    renderContext.cursorPosition.x += csiArgument(args, 0);
+    if (renderContext.cursorPosition.x > renderContext.screenTileSize.x - 1) {
+        renderContext.cursorPosition.x = renderContext.screenTileSize.x - 1;
+    }
+}
+
+static void csiCursorBack(struct CSIArguments *args) {
+    renderContext.cursorPosition.x -= csiArgument(args, 0);
+    if (renderContext.cursorPosition.x < 0) {
+        renderContext.cursorPosition.x = 0;
+    }
+}
+
+static void csiCursorNextLine(struct CSIArguments *args) {
+    int n = csiArgument(args, 0);
+    if (renderContext.cursorPosition.y + n < renderContext.screenTileSize.y) {
+        renderContext.cursorPosition.x = 0;
+        renderContext.cursorPosition.y += n;
+    }
+}
+
+static void csiCursorPreviousLine(struct CSIArguments *args) {
+    int n = csiArgument(args, 0);
+    if (renderContext.cursorPosition.y - n >= 0) {
+        renderContext.cursorPosition.x = 0;
+        renderContext.cursorPosition.y -= n;
+    }
+}
+
+static void csiCursorHorizontalAbsolute(struct CSIArguments *args) {
+    int x = csiArgument(args, 0) - 1;
+    renderContext.cursorPosition.x = x < renderContext.screenTileSize.x ? x : renderContext.screenTileSize.x - 1;
+}
+
+static void csiCursorPosition(struct CSIArguments *args) {
+    int y = csiArgument(args, 0) - 1;
+    int x = csiArgument(args, 1) - 1;
+    renderContext.cursorPosition.x = x < renderContext.screenTileSize.x ? x : renderContext.screenTileSize.x - 1;
+    renderContext.cursorPosition.y = y < renderContext.screenTileSize.y ? y : renderContext.screenTileSize.y - 1;
+}
+
+static void csiEraseInDisplay(struct CSIArguments *args) {
+    int n = csiArgument(args, 0);
+    if (n == 0) {
+        // Erase from cursor to end of screen
+        eraseScreenRect(renderContext.cursorPosition.x, renderContext.screenTileSize.x - 1, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
+        eraseScreenRect(0, renderContext.screenTileSize.x - 1, renderContext.cursorPosition.y + 1, renderContext.screenTileSize.y - 1);
+    } else if (n == 1) {
+        // Erase from start of screen to cursor
+        eraseScreenRect(0, renderContext.cursorPosition.x, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
+        eraseScreenRect(0, renderContext.screenTileSize.x - 1, 0, renderContext.cursorPosition.y - 1);
+    } else if (n == 2) {
+        // Erase whole screen
+        eraseScreenRect(0, renderContext.screenTileSize.x - 1, 0, renderContext.screenTileSize.y - 1);
+    } else if (n == 3) {
+        // Erase whole screen and scrollback buffer
+        eraseScreenRect(0, renderContext.screenTileSize.x - 1, 0, renderContext.screenTileSize.y - 1);
+        clearScrollback();
+    }
+}
+
+static void csiEraseInLine(struct CSIArguments *args) {
+    int n = csiArgument(args, 0);
+    if (n == 0) {
+        // Erase from cursor to end of line
+        eraseScreenRect(renderContext.cursorPosition.x, renderContext.screenTileSize.x - 1, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
+    } else if (n == 1) {
+        // Erase from start of line to cursor
+        eraseScreenRect(0, renderContext.cursorPosition.x, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
+    } else if (n == 2) {
+        // Erase entire line
+        eraseScreenRect(0, renderContext.screenTileSize.x - 1, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
+    }
+}
+
+static void csiScrollUp(struct CSIArguments *args) {
+    scrollUp(csiArgument(args, 0));
+}
+
+static void csiScrollDown(struct CSIArguments *args) {
+    scrollDown(csiArgument(args, 0));
+}
+
+static void csiSetScrollRegion(struct CSIArguments *args) {
+    const int top = csiArgument(args, 0) - 1;
+    const int bottom = args->count > 1 && args->values[1] > 0 ? args->values[1] - 1 : renderContext.screenTileSize.y - 1;
+    setScrollRegion(top, bottom);
+    renderContext.cursorPosition.x = 0;
+    renderContext.cursorPosition.y = 0;
+}
+
+static void csiInsertLines(struct CSIArguments *args) {
+    insertLines(csiArgument(args, 0));
+}
+
+static void csiDeleteLines(struct CSIArguments *args) {
+    deleteLines(csiArgument(args, 0));
+}
+
+static void csiInsertCharacters(struct CSIArguments *args) {
+    insertCharacters(csiArgument(args, 0));
+}
+
+static void csiDeleteCharacters(struct CSIArguments *args) {
+    deleteCharacters(csiArgument(args, 0));
+}
+
+static void csiEraseCharacters(struct CSIArguments *args) {
+    eraseCharacters(csiArgument(args, 0));
+}
+
+static void csiRepeatCharacter(struct CSIArguments *args) {
+    repeatCharacter(csiArgument(args, 0));
+}
+
+/**
+ * Sets or resets a DEC private mode (CSI ? n h / CSI ? n l).
+*/
+static void updatePrivateMode(int mode, int enabled) {
+    switch (mode) {
+        case 47: // Alternate screen
+            useAlternateScreen(enabled);
+            break;
+        case 1047: // Alternate screen, cleared when leaving it
+            if (!enabled && isAlternateScreen()) {
+                eraseScreenRect(0, renderContext.screenTileSize.x - 1, 0, renderContext.screenTileSize.y - 1);
+            }
+            useAlternateScreen(enabled);
+            break;
+        case 1048: // Save or restore cursor
+            if (enabled) {
+                saveCursor();
+            } else {
+                restoreCursor();
+            }
+            break;
+        case 1049: // Save cursor and switch to the cleared alternate screen
+            if (enabled) {
+                saveCursor();
+                useAlternateScreen(1);
+                eraseScreenRect(0, renderContext.screenTileSize.x - 1, 0, renderContext.screenTileSize.y - 1);
+            } else {
+                useAlternateScreen(0);
+                restoreCursor();
+            }
+            break;
+        default:
+            printf("unsupported private mode: %d\n", mode);
+            break;
+    }
+}
 
+static void csiSetPrivateMode(struct CSIArguments *args) {
+    for (int i = 0; i < args->count; i++) {
+        updatePrivateMode(csiArgument(args, i), 1);
+    }
+}
+
+static void csiResetPrivateMode(struct CSIArguments *args) {
+    for (int i = 0; i < args->count; i++) {
+        updatePrivateMode(csiArgument(args, i), 0);
+    }
+}
+
+/**
+ * Sets an extended color given in the colon form, 38:5:n or 38:2:[colorspace]:r:g:b, from the `count`
+ * sub-parameters after the 38 or 48. The colorspace is optional and ignored, and omitted values are 0.
+*/
+static void setExtendedColor(int *target, const int *values, int count) {
+    int components[4] = { 0 };
+    for (int i = 1; i < count && i <= 4; i++) {
+        components[i - 1] = values[i] < 0 ? 0 : values[i];
+    }
+    if (values[0] == 5 && count >= 2) {
+        *target = PALETTE_XTERM_BASE + (components[0] & 0xFF);
+    } else if (values[0] == 2 && count >= 5) {
+        *target = getTrueColorIndex(components[1], components[2], components[3]);
+    } else if (values[0] == 2 && count == 4) {
+        *target = getTrueColorIndex(components[0], components[1], components[2]);
+    } else {
+        printf("unhandled extended color mode: %d\n", values[0]);
+    }
+}
+
+static void csiGraphicsControl(struct CSIArguments *args) {
+    state.colorInput = COLOR_INPUT_NONE;
+    if (args->count == 0) {
+        updateGraphicsState(csiArgument(args, 0), 0);
+    }
+    for (int i = 0; i < args->count;) {
+        int end = i + 1;
+        while (end < args->count && args->subParameter[end]) end++;
+
+        const int command = csiArgument(args, i);
+        if (end > i + 1 && (command == 38 || command == 48) && state.colorInput == COLOR_INPUT_NONE) {
+            STATS_SGR(command);
+            int *target = command == 38 ? &renderContext.foregroundColor : &renderContext.backgroundColor;
+            setExtendedColor(target, &args->values[i + 1], end - i - 1);
+        } else {
+            // Sub-parameters of other attributes, such as the underline style in 4:3, are not supported.
+            updateGraphicsState(command, i);
+        }
+        i = end;
+    }
 }
 
-static void eraseScreenRect(int xStart, int xEnd, int yStart, int yEnd) {
-    for (int y = yStart; y <= yEnd; y++) {
-        int rowOffset = ((y + renderContext.glyphIndicesRowOffset) % MAX_ROWS) * MAX_CHARACTERS_PER_ROW;
-        for (int x = xStart; x <= xEnd; x++) {
-            renderContext.shaderContext->glyphIndices[rowOffset + x] = 0;
+/**
+ * Builds the dense dispatch table from CSI_SEQUENCES, indexed by private marker and final byte. Each marker and
+ * final byte pair supports a single intermediate byte.
+*/
+#define CSI_MARKER_INDEX(marker) ((marker) == 0 ? 0 : (marker) - 0x3B)
+#define CSI_SEQUENCE_ENTRY(finalByte, marker, intermediateByte, defaultArgument, cancelsPendingWrap, handlerFunction) \
+    [CSI_MARKER_INDEX(marker)][(finalByte) - CSI_FINAL_FIRST] = { \
+        .handler = handlerFunction, \
+        .defaultValue = defaultArgument, \
+        .intermediate = intermediateByte, \
+        .cancelsWrap = cancelsPendingWrap \
+    },
+
+static const struct CSISequence csiSequences[CSI_MARKER_COUNT][CSI_FINAL_LAST - CSI_FINAL_FIRST + 1] = {
+    CSI_SEQUENCES(CSI_SEQUENCE_ENTRY)
+};
+
+/**
+ * Splits a CSI sequence into its private marker, integer arguments, intermediate byte and final byte. Omitted
+ * arguments are stored as -1 so that the sequence's default can be applied. Returns 0 for malformed sequences.
+*/
+static int parseCSIArguments(const u8 *data, int length, struct CSIArguments *args) {
+    args->count = 0;
+    args->privateMarker = 0;
+    args->intermediate = 0;
+
+    int i = 0;
+    if (length > 1 && data[0] >= 0x3C && data[0] <= 0x3F) {
+        args->privateMarker = data[0];
+        i++;
+    }
+
+    int value = -1;
+    int subParameter = 0;
+    for (; i < length - 1; i++) {
+        const u8 c = data[i];
+        if (c >= '0' && c <= '9') {
+            value = (value < 0 ? 0 : value * 10) + (c - '0');
+            if (value > 0xFFFF) value = 0xFFFF;
+        } else if (c == ';' || c == ':') {
+            if (args->count < MAX_CSI_ARGUMENTS) {
+                args->subParameter[args->count] = subParameter;
+                args->values[args->count++] = value;
+            }
+            value = -1;
+            subParameter = c == ':';
+        } else if (c >= 0x20 && c <= 0x2F) {
+            args->intermediate = c;
+        } else {
+            return 0;
         }
     }
+
+    // The final argument is only stored if present, so "CSI m" has no arguments but "CSI 1;m" has two.
+    if ((value >= 0 || args->count > 0) && args->count < MAX_CSI_ARGUMENTS) {
+        args->subParameter[args->count] = subParameter;
+        args->values[args->count++] = value;
+    }
+    if (args->count == MAX_CSI_ARGUMENTS) {
+        printf("CSI command buffer filled, commands contains more than %d integer arguments: %s\n", MAX_CSI_ARGUMENTS, data);
+    }
+    return 1;
 }
 
 /**
@@ -280,161 +817,29 @@ static int executeCSICommandArgument() {
     u8 lastByte = state.argBuffer.data[state.argBuffer.position - 1];
 
     // CSI sequence is not yet terminated.
-    if (lastByte < 0x40 || lastByte > 0x7E) {
+    if (lastByte < CSI_FINAL_FIRST || lastByte > CSI_FINAL_LAST) {
         return 0;
     }
 
-    // Some CSI commands contain a list of semi-colon-separated integers used as arguments.
-    const int maxCSIArguments = 20;
-    int numArgs = 0;
-    int args[maxCSIArguments];
-    if ((lastByte >= 'A' && lastByte <= 'H') || lastByte == 'J' || lastByte == 'K' || lastByte == 'S' || lastByte == 'T' || lastByte == 'm') {
-        int argIndex = 0, value = 0, parsingValue = 0;
-        for (int i = 0; i < state.argBuffer.position; i++) {
-            const u8 c = state.argBuffer.data[i];
-            if (c == ';' || c == lastByte) {
-                if (parsingValue) {
-                    args[argIndex] = value;
-                    argIndex++;
-                }
-                value = 0;
-                parsingValue = 0;
+    STATS_CSI(state.argBuffer.data, state.argBuffer.position);
 
-                if (argIndex >= maxCSIArguments) {
-                    printf("CSI command buffer filled, commands contains more than %d integer arguments: %s\n", maxCSIArguments, state.argBuffer.data);
-                    break;
-                }
-            } else {
-                value = (value * 10) + (c - 0x30);
-                parsingValue = 1;
-            }
-        }
-        numArgs = argIndex;
+    struct CSIArguments args;
+    if (!parseCSIArguments(state.argBuffer.data, state.argBuffer.position, &args)) {
+        printf("unsupported csi command: %s\n", state.argBuffer.data);
+        return 1;
     }
 
-    switch (lastByte) {
-        case 'A': { // Cursor up
-            int n = numArgs == 0 ? 1 : args[0];
-            renderContext.cursorPosition.y -= n;
-            if (renderContext.cursorPosition.y < 0) {
-                renderContext.cursorPosition.y = 0;
-            }
-            break;
-        }
-        case 'B': { // Cursor down
-            int n = numArgs == 0 ? 1 : args[0];
-            renderContext.cursorPosition.y += n;
-            if (renderContext.cursorPosition.y > renderContext.screenTileSize.y - 1) {
-                renderContext.cursorPosition.y = renderContext.screenTileSize.y - 1;
-            }
-            break;
-        }
-        case 'C': { // Cursor forward
-            int n = numArgs == 0 ? 1 : args[0];
-            renderContext.cursorPosition.x += n;
-            if (renderContext.cursorPosition.x > renderContext.screenTileSize.x - 1) {
-                renderContext.cursorPosition.x = renderContext.screenTileSize.x - 1;
-            }
-            break;
-        }
-        case 'D': { // Cursor back
-            int n = numArgs == 0 ? 1 : args[0];
-            renderContext.cursorPosition.x -= n;
-            if (renderContext.cursorPosition.x < 0) {
-                renderContext.cursorPosition.x = 0;
-            }
-            break;
-        }
-        case 'E': { // Cursor next line
-            int n = numArgs == 0 ? 1 : args[0];
-            if (renderContext.cursorPosition.y + n < renderContext.screenTileSize.y) {
-                renderContext.cursorPosition.x = 0;
-                renderContext.cursorPosition.y += n;
-            }
-            break;
-        }
-        case 'F': { // Cursor previous line
-            int n = numArgs == 0 ? 1 : args[0];
-            if (renderContext.cursorPosition.y - n >= 0) {
-                renderContext.cursorPosition.x = 0;
-                renderContext.cursorPosition.y -= n;
-            }
-            break;
-        }
-        case 'G': { // Cursor horizontal absolute
-            int n = numArgs == 0 ? 0 : args[0];
-            if (n < renderContext.screenTileSize.x) {
-                renderContext.cursorPosition.x = n;
-            }
-            break;
-        }
-        case 'H': { // Cursor position
-            // TODO: doesn't handle cases like CSI ;5H, which should use column 1 as the default x value.
-            int x = numArgs == 1 ? args[0] - 1 : 0;
-            int y = numArgs == 2 ? args[1] - 1 : 0;
-            if (x < renderContext.screenTileSize.x && y < renderContext.screenTileSize.y) {
-                renderContext.cursorPosition.x = x;
-                renderContext.cursorPosition.y = y;
-            }
-            break;
-        }
-        case 'J': { // Erase in display
-            int n = numArgs == 1 ? args[0] : 0;
-            if (n == 0) {
-                // Erase from cursor to end of screen
-                eraseScreenRect(renderContext.cursorPosition.x, renderContext.screenTileSize.x - 1, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
-                eraseScreenRect(0, renderContext.screenTileSize.x - 1, 0, renderContext.cursorPosition.y - 1);
-            } else if (n == 1) {
-                // Erase from start of screen to cursor
-                eraseScreenRect(0, renderContext.cursorPosition.x, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
-                eraseScreenRect(0, renderContext.screenTileSize.x - 1, renderContext.cursorPosition.y + 1, renderContext.screenTileSize.y - 1);
-            } else if (n == 2) {
-                // Erase whole screen
-                eraseScreenRect(0, renderContext.screenTileSize.x - 1, 0, renderContext.screenTileSize.y - 1);
-            } else if (n == 3) {
-                // Erase whole screen and scrollback buffer
-                eraseScreenRect(0, renderContext.screenTileSize.x - 1, 0, renderContext.screenTileSize.y - 1);
-                // TODO: erase back buffer
-            }
-            break;
-        }
-        case 'K': { // Erase in line
-            int n = numArgs == 1 ? args[0] : 0;
-            if (n == 0) {
-                // Erase from cursor to end of line
-                eraseScreenRect(renderContext.cursorPosition.x, renderContext.screenTileSize.x - 1, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
-            } else if (n == 1) {
-                // Erase from start of line to cursor
-                eraseScreenRect(0, renderContext.cursorPosition.x, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
-            } else if (n == 2) {
-                // Erase entire line
-                eraseScreenRect(0, renderContext.screenTileSize.x - 1, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
-            }
-            break;
-        }
-        case 'S': { // Scroll up
-            int n = numArgs == 1 ? args[0] : 1;
-            printf("CSI S (%d) not implemented\n", n);
-            break;
-        }
-        case 'T': { // Scroll down
-            int n = numArgs == 1 ? args[0] : 1;
-            printf("CSI T (%d) not implemented\n", n);
-            break;
-        }
-        case 'm': { // Graphics control
-            if (numArgs == 0) {
-                updateGraphicsState(0, 0);
-            }
-            for (int i = 0; i < numArgs; i++) {
-                updateGraphicsState(args[i], i);
-            }
-            break;
-        }
-        default:
-            printf("unsupported csi command: %s\n", state.argBuffer.data);
+    const struct CSISequence *sequence = &csiSequences[CSI_MARKER_INDEX(args.privateMarker)][lastByte - CSI_FINAL_FIRST];
+    if (!sequence->handler || sequence->intermediate != args.intermediate) {
+        printf("unsupported csi command: %s\n", state.argBuffer.data);
+        return 1;
     }
 
+    if (sequence->cancelsWrap) {
+        renderContext.wrapPending = 0;
+    }
+    args.defaultValue = sequence->defaultValue;
+    sequence->handler(&args);
     return 1;
 }
 
@@ -444,39 +849,93 @@ static int executeDCSCommandArgument() {
 }
 
 /**
- * OSC commands start with ESC] and are terminated with BEL or ST.
+ * Runs a terminated OSC command. The argument buffer holds the command, except for clipboard payloads and hyperlink
+ * URIs which were streamed to their modules as they arrived.
 */
-static int executeOSCCommandArgument() {
-    if (state.argBuffer.position == 0) {
-        return 1;
+static void executeOSCCommand() {
+    STATS_OSC(state.argBuffer.data, state.argBuffer.position);
+
+    if (state.commandState == COMMAND_OSC_CLIPBOARD) {
+        clipboardEnd();
+    } else if (state.commandState == COMMAND_OSC_HYPERLINK) {
+        hyperlinkEnd();
+    } else if (state.commandState == COMMAND_OSC_NOT_SUPPORTED) {
+        printf("unsupported osc command: %s\n", state.argBuffer.data);
+    } else if (state.argBuffer.data[0] == '0' && state.argBuffer.data[1] == ';') {
+        requestWindowTitle((const char *) state.argBuffer.data + 2);
+    } else {
+        printf("unsupported osc command: %s\n", state.argBuffer.data);
     }
 
+    state.commandState = COMMAND_NONE;
+    clearBuffer(&state.argBuffer);
+    state.currentStage = STAGE_PLAIN_TEXT;
+}
+
+/**
+ * OSC commands start with ESC] and are terminated with BEL or ST (0x9C or ESC\). Bytes are collected in the
+ * argument buffer, except for the payload of OSC 52 (52;<selection>;<base64>), which can be megabytes long and is
+ * streamed to the clipboard module instead, and the URI of OSC 8 (8;<params>;<uri>), which is streamed to the
+ * hyperlink module.
+*/
+static int handleStageOSC(u8 byte, int *character) {
     const u8 BEL = 0x7;
+    const u8 ESC = 0x1B;
     const u8 ST = 0x9C;
-    const u8 lastByte = state.argBuffer.data[state.argBuffer.position - 1];
 
-    // OSC sequence is not yet terminated
-    if (lastByte != BEL && lastByte != ST) {
+    if (state.oscEscape) {
+        state.oscEscape = 0;
+        executeOSCCommand();
+        // Any escape sequence other than ST also ends the command, and is then handled as usual.
+        if (byte != '\\') {
+            state.currentStage = STAGE_ESCAPE;
+            return handleStageEscape(byte, character);
+        }
         return 0;
     }
 
-    if (state.argBuffer.data[0] == '0' && state.argBuffer.data[1] == ';') {
-        const int byteOffset = 2;
-        u8 *windowTitle = state.argBuffer.data + byteOffset;
-        windowTitle[state.argBuffer.position - byteOffset - 1] = '\0';
-        glfwSetWindowTitle(renderContext.window, (const char *) windowTitle);
-    } else {
-        printf("unsupported osc command: %s\n", state.argBuffer.data);
+    if (byte == ESC) {
+        state.oscEscape = 1;
+        return 0;
+    } else if (byte == BEL || byte == ST) {
+        executeOSCCommand();
+        return 0;
     }
 
-    return 1;
+    if (state.commandState == COMMAND_OSC_CLIPBOARD) {
+        clipboardAppend(byte);
+        return 0;
+    } else if (state.commandState == COMMAND_OSC_HYPERLINK) {
+        hyperlinkAppend(byte);
+        return 0;
+    } else if (state.commandState == COMMAND_OSC_NOT_SUPPORTED) {
+        return 0;
+    }
+
+    // The buffer always keeps its last byte as a null terminator.
+    if (state.argBuffer.position == state.argBuffer.length - 1) {
+        state.commandState = COMMAND_OSC_NOT_SUPPORTED;
+        return 0;
+    }
+    state.argBuffer.data[state.argBuffer.position++] = byte;
+
+    // Once the selection of an OSC 52 command is known, the remaining bytes are the clipboard payload.
+    const u8 *data = state.argBuffer.data;
+    const int position = state.argBuffer.position;
+    if (byte == ';' && position > 3 && data[0] == '5' && data[1] == '2' && data[2] == ';') {
+        clipboardBegin(data + 3, position - 4);
+        state.commandState = COMMAND_OSC_CLIPBOARD;
+    } else if (byte == ';' && position > 2 && data[0] == '8' && data[1] == ';') {
+        hyperlinkBegin(data + 2, position - 3);
+        state.commandState = COMMAND_OSC_HYPERLINK;
+    }
+    return 0;
 }
 
 static int executeCommandArgument() {
     switch (state.sequenceType) {
         case SEQUENCE_TYPE_CSI: return executeCSICommandArgument();
         case SEQUENCE_TYPE_DCS: return executeDCSCommandArgument();
-        case SEQUENCE_TYPE_OSC: return executeOSCCommandArgument();
         default: return 0;
     }
 }
@@ -3,3 +3,4 @@
 typedef unsigned char u8;
 
 int processTextByte(u8 byte, int *character);
+void processText(const u8 *data, int length);
@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "terminal.h"
+#include "clipboard.h"
+#include "effects.h"
+
+#define MAX_WINDOW_TITLE_LENGTH 256
+
+/**
+ * Window system side effects requested by the shell while parsing. Only the latest value of each is kept, and
+ * they are applied once per frame, so a burst of title changes or bells costs a single call to the window system.
+*/
+struct WindowEffects {
+    char title[MAX_WINDOW_TITLE_LENGTH];
+    int titleChanged;
+    // Title last passed to GLFW, used to skip setting the same title again.
+    char appliedTitle[MAX_WINDOW_TITLE_LENGTH];
+    int bell;
+};
+
+extern struct RenderContext renderContext;
+
+static struct WindowEffects effects;
+
+void requestWindowTitle(const char *title) {
+    strncpy(effects.title, title, MAX_WINDOW_TITLE_LENGTH - 1);
+    effects.title[MAX_WINDOW_TITLE_LENGTH - 1] = '\0';
+    effects.titleChanged = 1;
+}
+
+void requestBell() {
+    effects.bell = 1;
+}
+
+/**
+ * Applies the side effects requested since the last frame. Called once per frame after the shell output is parsed.
+*/
+void flushWindowEffects() {
+    if (effects.titleChanged) {
+        effects.titleChanged = 0;
+        if (strcmp(effects.title, effects.appliedTitle) != 0) {
+            strcpy(effects.appliedTitle, effects.title);
+            glfwSetWindowTitle(renderContext.window, effects.title);
+        }
+    }
+
+    // The bell marks the window as urgent, unless the user is already looking at it.
+    if (effects.bell) {
+        effects.bell = 0;
+        if (!renderContext.windowFocused) {
+            glfwRequestWindowAttention(renderContext.window);
+        }
+    }
+
+    flushClipboard();
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+void requestWindowTitle(const char *title);
+void requestBell();
+void flushWindowEffects();
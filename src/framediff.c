@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "terminal.h"
+#include "framediff.h"
+#include "grid.h"
+
+extern struct RenderContext renderContext;
+
+/**
+ * A row moved from screen row `from` of the last frame to screen row `to`, along with the `count - 1` rows after it.
+*/
+struct FrameMove {
+    int from;
+    int to;
+    int count;
+};
+
+/**
+ * The last frame, and the records describing how the current frame differs from it.
+*/
+struct FrameDiff {
+    // Cells of the last frame, `columns` per row, with erased cells filled in.
+    unsigned int *cells;
+    int columns;
+    int rows;
+    // Row of `cells` holding each screen row, permuted by scrolls instead of moving cells.
+    int *frameRows;
+    int *scratchRows;
+    // Row map entry each screen row was compared with. Rows without one, such as those uncovered by a scroll, have
+    // a row of -1 and are compared in full.
+    struct ShaderRow *shown;
+    // Grid that `shown` refers to. Rows of a replaced grid are compared in full.
+    const struct CellGrid *grid;
+    // Bit for each column of the row being compared, set where it changed.
+    unsigned long long *changed;
+    // Screen row that showed each grid row in the last frame, or -1.
+    int *positions;
+    int positionCount;
+    struct FrameMove *moves;
+    struct FrameChange *changes;
+    int changeCount;
+    int changeCapacity;
+};
+
+static struct FrameDiff frameDiff;
+
+static void addChange(struct FrameChange change) {
+    if (frameDiff.changeCount == frameDiff.changeCapacity) {
+        frameDiff.changeCapacity = frameDiff.changeCapacity ? frameDiff.changeCapacity * 2 : 256;
+        frameDiff.changes = realloc(frameDiff.changes, frameDiff.changeCapacity * sizeof(struct FrameChange));
+    }
+    frameDiff.changes[frameDiff.changeCount++] = change;
+}
+
+/**
+ * Sets the bits of `changed` for the columns in [x, end) where `frame` differs from `cells`, or from `blank` when
+ * `cells` is null. Compares 16 cells at a time, giving a bit for each.
+*/
+static void findChangedCells(unsigned long long *changed, const unsigned int *frame, const unsigned int *cells,
+    unsigned int blank, int x, int end) {
+#ifdef __SSE2__
+    const __m128i blanks = _mm_set1_epi32((int) blank);
+    for (; x + 16 <= end; x += 16) {
+        __m128i equal[4];
+        for (int i = 0; i < 4; i++) {
+            const __m128i other = cells ? _mm_loadu_si128((const __m128i *) &cells[x + i * 4]) : blanks;
+            equal[i] = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) &frame[x + i * 4]), other);
+        }
+        const __m128i low = _mm_packs_epi32(equal[0], equal[1]);
+        const __m128i high = _mm_packs_epi32(equal[2], equal[3]);
+        const unsigned long long bits = ~_mm_movemask_epi8(_mm_packs_epi16(low, high)) & 0xFFFF;
+        if (bits) {
+            changed[x / 64] |= bits << (x % 64);
+            if (x % 64 > 48) changed[x / 64 + 1] |= bits >> (64 - x % 64);
+        }
+    }
+#endif
+    for (; x < end; x++) {
+        if (frame[x] != (cells ? cells[x] : blank)) changed[x / 64] |= 1ull << (x % 64);
+    }
+}
+
+/**
+ * Returns the first column in [x, end) whose bit in `changed` is `value`, or `end`.
+*/
+static int findBit(const unsigned long long *changed, int value, int x, int end) {
+    while (x < end) {
+        const unsigned long long bits = (value ? changed[x / 64] : ~changed[x / 64]) >> (x % 64);
+        if (bits) {
+            x += __builtin_ctzll(bits);
+            return x < end ? x : end;
+        }
+        x = (x / 64 + 1) * 64;
+    }
+    return end;
+}
+
+/**
+ * Compares columns [start, end) of screen row `y` with the grid row shown there, adding a span for each run of
+ * changes and copying the changed cells to the last frame.
+*/
+static void diffRow(int y, const struct ShaderRow *row, int start, int end) {
+    const struct CellGrid *grid = renderContext.grid;
+    const unsigned int *cells = &grid->cells[row->row * grid->columns];
+    unsigned int *frame = &frameDiff.cells[frameDiff.frameRows[y] * frameDiff.columns];
+    unsigned long long *changed = frameDiff.changed;
+    const int written = row->blankFrom < end ? row->blankFrom : end;
+
+    memset(&changed[start / 64], 0, (end / 64 - start / 64 + 1) * sizeof(unsigned long long));
+    if (start < written) {
+        findChangedCells(changed, frame, cells, 0, start, written);
+    }
+    findChangedCells(changed, frame, 0, row->blank, start > written ? start : written, end);
+
+    int x = findBit(changed, 1, start, end);
+    while (x < end) {
+        int spanEnd = findBit(changed, 0, x, end);
+        int next = findBit(changed, 1, spanEnd, end);
+        while (next < end && next - spanEnd < FRAME_DIFF_GAP) {
+            spanEnd = findBit(changed, 0, next, end);
+            next = findBit(changed, 1, spanEnd, end);
+        }
+
+        addChange((struct FrameChange) { .type = FRAME_CELLS, .top = y, .bottom = y, .start = x, .end = spanEnd });
+        const int copied = written < spanEnd ? written : spanEnd;
+        if (x < copied) {
+            memcpy(&frame[x], &cells[x], (copied - x) * sizeof(unsigned int));
+        }
+        for (int i = x > copied ? x : copied; i < spanEnd; i++) {
+            frame[i] = row->blank;
+        }
+        x = next;
+    }
+}
+
+/**
+ * Moves rows [top, bottom] of the last frame up by `count` rows, or down when it is negative, and blanks the rows
+ * uncovered at the other end. Only the order of the frame's rows changes, like the rows of a screen.
+*/
+static void scrollFrame(int top, int bottom, int count) {
+    const int columns = frameDiff.columns;
+    const int distance = count > 0 ? count : -count;
+    const int moved = bottom - top + 1 - distance;
+    const int from = count > 0 ? top + distance : top;
+    const int to = count > 0 ? top : top + distance;
+    const int blankTop = count > 0 ? bottom - distance + 1 : top;
+
+    int *uncovered = frameDiff.scratchRows;
+    memcpy(uncovered, &frameDiff.frameRows[count > 0 ? top : bottom - distance + 1], distance * sizeof(int));
+    memmove(&frameDiff.frameRows[to], &frameDiff.frameRows[from], moved * sizeof(int));
+    memcpy(&frameDiff.frameRows[blankTop], uncovered, distance * sizeof(int));
+    memmove(&frameDiff.shown[to], &frameDiff.shown[from], moved * sizeof(struct ShaderRow));
+    for (int y = blankTop; y < blankTop + distance; y++) {
+        memset(&frameDiff.cells[frameDiff.frameRows[y] * columns], 0, columns * sizeof(unsigned int));
+        frameDiff.shown[y] = (struct ShaderRow) { .row = -1 };
+    }
+}
+
+/**
+ * Finds runs of screen rows showing the grid rows that consecutive rows of the last frame showed, and applies them
+ * to the last frame as scrolls. A run is taken as a scroll of the rows it spans together with the rows it
+ * uncovers, so runs whose scrolls would overlap an earlier one are left to be compared instead.
+*/
+static void findScrolls(const struct ShaderRow *rows) {
+    const int rowCount = frameDiff.rows;
+    int *positions = frameDiff.positions;
+    for (int y = 0; y < rowCount; y++) {
+        if (frameDiff.shown[y].row >= 0) positions[frameDiff.shown[y].row] = y;
+    }
+
+    int moveCount = 0;
+    int scrolledTo = -1;
+    for (int y = 0; y < rowCount;) {
+        const int from = rows[y].row == frameDiff.shown[y].row ? -1 : positions[rows[y].row];
+        if (from < 0) {
+            y++;
+            continue;
+        }
+
+        int count = 1;
+        while (y + count < rowCount && from + count < rowCount
+            && rows[y + count].row == frameDiff.shown[from + count].row) {
+            count++;
+        }
+        const int top = from < y ? from : y;
+        if (top > scrolledTo) {
+            frameDiff.moves[moveCount++] = (struct FrameMove) { .from = from, .to = y, .count = count };
+            scrolledTo = (from > y ? from : y) + count - 1;
+        }
+        y += count;
+    }
+
+    for (int y = 0; y < rowCount; y++) {
+        if (frameDiff.shown[y].row >= 0) positions[frameDiff.shown[y].row] = -1;
+    }
+    for (int i = 0; i < moveCount; i++) {
+        const struct FrameMove *move = &frameDiff.moves[i];
+        const int top = move->from < move->to ? move->from : move->to;
+        const int bottom = (move->from > move->to ? move->from : move->to) + move->count - 1;
+        const int count = move->from - move->to;
+        addChange((struct FrameChange) { .type = FRAME_SCROLL, .top = top, .bottom = bottom, .count = count });
+        scrollFrame(top, bottom, count);
+    }
+}
+
+/**
+ * Starts over from a blank frame of the current size.
+*/
+static void resizeFrame(int columns, int rows) {
+    frameDiff.columns = columns;
+    frameDiff.rows = rows;
+    frameDiff.cells = realloc(frameDiff.cells, (size_t) columns * rows * sizeof(unsigned int));
+    frameDiff.frameRows = realloc(frameDiff.frameRows, rows * sizeof(int));
+    frameDiff.scratchRows = realloc(frameDiff.scratchRows, rows * sizeof(int));
+    frameDiff.shown = realloc(frameDiff.shown, rows * sizeof(struct ShaderRow));
+    frameDiff.moves = realloc(frameDiff.moves, rows * sizeof(struct FrameMove));
+    frameDiff.changed = realloc(frameDiff.changed, (columns / 64 + 1) * sizeof(unsigned long long));
+    memset(frameDiff.cells, 0, (size_t) columns * rows * sizeof(unsigned int));
+    for (int y = 0; y < rows; y++) {
+        frameDiff.frameRows[y] = y;
+        frameDiff.shown[y] = (struct ShaderRow) { .row = -1 };
+    }
+    addChange((struct FrameChange) { .type = FRAME_RESIZE, .top = 0, .bottom = rows - 1, .start = 0, .end = columns });
+}
+
+/**
+ * Compares the screen rows shown by `rows`, see getDisplayedRows(), with the last frame, and makes them the last
+ * frame. Returns the records describing the changes and sets `*count` to their number. The first call describes
+ * the frame as changes to a blank one.
+*/
+const struct FrameChange *diffFrame(const struct ShaderRow *rows, int *count) {
+    struct CellGrid *grid = renderContext.grid;
+    const int columns = grid->columns;
+    const int rowCount = renderContext.screenTileSize.y;
+    frameDiff.changeCount = 0;
+
+    if (columns != frameDiff.columns || rowCount != frameDiff.rows) {
+        resizeFrame(columns, rowCount);
+    }
+    // A grid not diffed before has no dirty columns kept for the differ, so all of its rows are compared once.
+    if (grid != frameDiff.grid || grid->dirtySets <= GRID_FRAME_DIFF_SET) {
+        for (int y = 0; y < rowCount; y++) {
+            frameDiff.shown[y].row = -1;
+        }
+        trackFrameDiff(grid);
+        frameDiff.grid = grid;
+    }
+    if (grid->rows > frameDiff.positionCount) {
+        frameDiff.positions = realloc(frameDiff.positions, grid->rows * sizeof(int));
+        for (int i = frameDiff.positionCount; i < grid->rows; i++) {
+            frameDiff.positions[i] = -1;
+        }
+        frameDiff.positionCount = grid->rows;
+    }
+
+    findScrolls(rows);
+
+    // Rows still showing the grid row they were compared with only need their dirty columns compared, unless they
+    // were erased differently since.
+    const int *dirtyStart = grid->dirtyStart[GRID_FRAME_DIFF_SET];
+    const int *dirtyEnd = grid->dirtyEnd[GRID_FRAME_DIFF_SET];
+    for (int y = 0; y < rowCount; y++) {
+        const struct ShaderRow *row = &rows[y];
+        struct ShaderRow *last = &frameDiff.shown[y];
+        if (row->row == last->row && row->blankFrom == last->blankFrom && row->blank == last->blank) {
+            const int end = dirtyEnd[row->row] < row->blankFrom ? dirtyEnd[row->row] : row->blankFrom;
+            if (dirtyStart[row->row] < end) {
+                diffRow(y, row, dirtyStart[row->row], end);
+            }
+        } else {
+            diffRow(y, row, 0, columns);
+            *last = *row;
+        }
+    }
+
+    for (int i = 0; i < grid->dirtyRowCount[GRID_FRAME_DIFF_SET]; i++) {
+        const int row = grid->dirtyRows[GRID_FRAME_DIFF_SET][i];
+        grid->dirtyStart[GRID_FRAME_DIFF_SET][row] = grid->dirtyEnd[GRID_FRAME_DIFF_SET][row] = 0;
+    }
+    grid->dirtyRowCount[GRID_FRAME_DIFF_SET] = 0;
+
+    *count = frameDiff.changeCount;
+    return frameDiff.changes;
+}
+
+/**
+ * Returns the cells of screen row `y` of the last frame diffed, where the cells of its spans can be read.
+*/
+const unsigned int *getFrameRow(int y) {
+    return &frameDiff.cells[frameDiff.frameRows[y] * frameDiff.columns];
+}
+
+void freeFrameDiff() {
+    free(frameDiff.cells);
+    free(frameDiff.frameRows);
+    free(frameDiff.scratchRows);
+    free(frameDiff.shown);
+    free(frameDiff.changed);
+    free(frameDiff.positions);
+    free(frameDiff.moves);
+    free(frameDiff.changes);
+    memset(&frameDiff, 0, sizeof(frameDiff));
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+/**
+ * Frame differ, reporting what changed on the screen since it was last called. It keeps a copy of the cells of the
+ * last frame and compares the displayed rows against it, describing the difference as a list of change records:
+ * scrolls first, then the changed spans of each row in order. Applying the records to the last frame gives the
+ * current one. Cells are compared as packed values, see cell.h, so glyphs and styles are resolved by the consumer.
+ *
+ * Only rows whose row map entry changed or whose cells were marked dirty in the grid are compared, so an unchanged
+ * frame costs a pass over the row map.
+*/
+// Unchanged cells between two changes of a row before they are reported as separate spans.
+#define FRAME_DIFF_GAP 8
+
+enum FrameChangeType {
+    // The frame was resized to `end` columns and `bottom + 1` rows of blank cells.
+    FRAME_RESIZE,
+    // Rows [top, bottom] moved up by `count` rows, or down when it is negative. The rows uncovered at the other end
+    // are blank.
+    FRAME_SCROLL,
+    // Columns [start, end) of row `top` changed.
+    FRAME_CELLS
+};
+
+struct FrameChange {
+    enum FrameChangeType type;
+    int top;
+    int bottom;
+    int count;
+    int start;
+    int end;
+};
+
+const struct FrameChange *diffFrame(const struct ShaderRow *rows, int *count);
+const unsigned int *getFrameRow(int y);
+void freeFrameDiff();
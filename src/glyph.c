@@ -6,128 +6,121 @@
 
 #include "terminal.h"
 #include "glyph.h"
+#include "cluster.h"
+
+#define GLYPH_HASH_SIZE (GLYPH_TABLE_SIZE * 2)
+#define ATLAS_SLOTS (ATLAS_WIDTH * ATLAS_HEIGHT)
+// Atlas position 0 is never rendered to, so glyphs without a position and blank glyphs draw nothing.
+#define ATLAS_SLOT_BLANK 0
 
-static const int CACHE_SIZE = 1024;
 static const int REPLACEMENT_CODEPOINT = 0xFFFD;
 
-struct GlyphEntry;
-struct GlyphEntry {
-    int codePoint;
-    unsigned short atlasPosition;
-    struct GlyphEntry *previousLRUEntry;
-    struct GlyphEntry *nextLRUEntry;
-    struct GlyphEntry *nextCacheEntry;
+/**
+ * An atlas position and the glyph rendered to it, -1 if none. Positions are kept in least recently used order,
+ * and each records the last scan of the screen that found its glyph visible, see isSlotPinned().
+*/
+struct AtlasSlot {
+    int glyph;
+    int scan;
+    short previous;
+    short next;
 };
 
-struct GlyphEntry *glyphCacheBasePointer;
-struct GlyphEntry **glyphCache;
-struct GlyphEntry *lruStart;
-struct GlyphEntry *lruEnd;
+static unsigned int glyphKeys[GLYPH_TABLE_SIZE];
+static unsigned short glyphSlots[GLYPH_TABLE_SIZE];
+// Ids that were never used start at nextId, ids freed by collectGlyphs() are kept in freeIds.
+static int nextId = GLYPH_FIXED_IDS;
+static unsigned short freeIds[GLYPH_TABLE_SIZE];
+static int freeCount = 0;
+static int glyphCount = GLYPH_FIXED_IDS;
+// Unused glyph ids are collected at the next frame once this many are taken.
+static int collectAt = GLYPH_TABLE_SIZE * 3 / 4;
+// Open addressing table of interned glyph ids. 0 marks an empty slot, since fixed ids are never looked up.
+static unsigned short glyphTable[GLYPH_HASH_SIZE];
+// Range of ids whose atlas position changed since the table was last written to each shader context slot.
+static int dirtyStart[SHADER_CONTEXT_SLOTS];
+static int dirtyEnd[SHADER_CONTEXT_SLOTS];
+
+static struct AtlasSlot slots[ATLAS_SLOTS];
+static int lruFirst;
+static int lruLast;
+// Scans of the visible cells are numbered, and the frame of each of the last few is kept to tell which glyphs the
+// GPU may still be drawing.
+static int frame = 0;
+static int scanIndex = 0;
+static int scanFrames[SHADER_CONTEXT_SLOTS];
+// Visible rows at the last scan. The screen is scanned again only when they or their cells have changed.
+static struct ShaderRow *scannedRows;
+static int scannedRowCount;
+static int rescan;
 
 FT_Library library;
 FT_Face face;
 
 extern struct RenderContext renderContext;
 
-/**
- * 32-bit FNV hash with XOR folding to reduce output to 10 bits.
-*/
-static int fnvHash10(int v) {
-    int prime = 0x01000193;
-    int hash = 0x811c9dc5;
-    for (int i = 0; i < 32; i+=8) {
-        hash = hash * prime;
-        hash = hash ^ (v >> i);
-    }
-    return ((hash >> 10) ^ hash) & 0x3FF;
-}
-
 static int inRange(int v, int min, int max) {
     if (v < min) return min;
     if (v > max) return max;
     return v;
 }
 
-void freeGlyphCache() {
-    free(glyphCache);
-    free(glyphCacheBasePointer);
-}
-
-void initGlyphCache() {
-    glyphCache = malloc(sizeof(struct GlyphEntry*) * CACHE_SIZE);
-    memset(glyphCache, 0, sizeof(struct GlyphEntry*) * CACHE_SIZE);
-    glyphCacheBasePointer = malloc(sizeof(struct GlyphEntry) * CACHE_SIZE);
-
-    // Initialize cache with empty entries
-    struct GlyphEntry *prevEntry = 0;
-    for (int atlasPosition = 0; atlasPosition < ATLAS_WIDTH * ATLAS_HEIGHT; atlasPosition++) {
-        struct GlyphEntry *entry = glyphCacheBasePointer + atlasPosition;
-        entry->codePoint = 0xFFFF0000 | atlasPosition;
-        entry->atlasPosition = atlasPosition;
-        entry->nextCacheEntry = 0;
-        entry->previousLRUEntry = 0;
-        entry->nextLRUEntry = 0;
-
-        int hash = fnvHash10(entry->codePoint);
-        if (glyphCache[hash]) {
-            struct GlyphEntry *current = glyphCache[hash];
-            while (current->nextCacheEntry) {
-                current = current->nextCacheEntry;
-            }
-            current->nextCacheEntry = entry;
-        } else {
-            glyphCache[hash] = entry;
-        }
-
-        entry->previousLRUEntry = prevEntry;
-        if (prevEntry) {
-            prevEntry->nextLRUEntry = entry;
-        } else {
-            lruStart = entry;
-        }
-        prevEntry = entry;
-    }
-
-    lruEnd = prevEntry;
-
-    // Pre-load cache with printable ascii characters
-    for (int asciiCode = 0x20; asciiCode <= 0x7E; asciiCode++) {
-        getGlyphAtlasPosition(asciiCode);
-    }
-}
-
 void addCodePointToAtlas(unsigned int codePoint, unsigned short atlasPosition) {
     int atlasTileX = atlasPosition % ATLAS_WIDTH;
     int atlasTileY = (int) (atlasPosition / ATLAS_WIDTH);
     int glyphSizeX = renderContext.atlasGlyphSize.x;
     int glyphSizeY = renderContext.atlasGlyphSize.y;
 
-    FT_UInt glyphIndex = FT_Get_Char_Index(face, codePoint);
-    if (FT_Load_Glyph(face, glyphIndex, 0)) {
-        printf("Error loading glyph for %d\n", glyphIndex);
-        glyphIndex = FT_Get_Char_Index(face, REPLACEMENT_CODEPOINT);
-        FT_Load_Glyph(face, glyphIndex, 0);
-    }
-    if (face->glyph->format != FT_GLYPH_FORMAT_BITMAP) {
-        FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
+    // The halves of a wide glyph are cut from a bitmap two advances wide rather than squeezed into one tile.
+    const int half = codePoint & (GLYPH_LEFT_HALF | GLYPH_RIGHT_HALF);
+    const int halfOffset = codePoint & GLYPH_RIGHT_HALF ? glyphSizeX : 0;
+
+    // A cluster draws its combining characters over the base character, each at the pen position the previous
+    // character advanced to.
+    int singleCodePoint = codePoint & GLYPH_CODEPOINT_MASK;
+    const int *codePoints = &singleCodePoint;
+    int codePointCount = 1;
+    if (codePoint & GLYPH_CLUSTER) {
+        codePointCount = getClusterCodePoints(codePoint & GLYPH_CODEPOINT_MASK, &codePoints);
     }
-    FT_Bitmap *bitmap = &face->glyph->bitmap;
-
-    unsigned int bitmapWidth = face->glyph->bitmap.width;
-    unsigned int bitmapHeight = face->glyph->bitmap.rows;
-
-    int xOffset = (int) face->glyph->metrics.horiBearingX >> 6;
-    int yOffset = (int) (face->glyph->metrics.height - face->glyph->metrics.horiBearingY) >> 6;
 
     // TODO: reuse a pre-allocated char array
     char *flippedBitmap = malloc(sizeof(char) * glyphSizeX * glyphSizeY);
     memset(flippedBitmap, 0, glyphSizeX * glyphSizeY);
-    for (int x = 0; x < bitmapWidth; x++) {
-        for (int y = 0; y < bitmapHeight; y++) {
-            int adjustedX = inRange(x + xOffset, 0, renderContext.atlasGlyphSize.x - 1);
-            int adjustedY = inRange(y + renderContext.lineSpacing + renderContext.maxBelowBaseline - yOffset, 0, renderContext.atlasGlyphSize.y - 1);
-            flippedBitmap[adjustedY * glyphSizeX + adjustedX] = bitmap->buffer[(bitmapHeight - y - 1) * bitmapWidth + x];
+    int penX = -halfOffset;
+    for (int i = 0; i < codePointCount; i++) {
+        FT_UInt glyphIndex = FT_Get_Char_Index(face, codePoints[i]);
+        if (FT_Load_Glyph(face, glyphIndex, 0)) {
+            printf("Error loading glyph for %d\n", glyphIndex);
+            glyphIndex = FT_Get_Char_Index(face, REPLACEMENT_CODEPOINT);
+            FT_Load_Glyph(face, glyphIndex, 0);
+        }
+        if (face->glyph->format != FT_GLYPH_FORMAT_BITMAP) {
+            FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
+        }
+        FT_Bitmap *bitmap = &face->glyph->bitmap;
+
+        unsigned int bitmapWidth = face->glyph->bitmap.width;
+        unsigned int bitmapHeight = face->glyph->bitmap.rows;
+
+        int xOffset = (int) face->glyph->metrics.horiBearingX >> 6;
+        int yOffset = (int) (face->glyph->metrics.height - face->glyph->metrics.horiBearingY) >> 6;
+
+        for (int x = 0; x < bitmapWidth; x++) {
+            for (int y = 0; y < bitmapHeight; y++) {
+                int adjustedX = x + xOffset + penX;
+                if ((half || i > 0) && (adjustedX < 0 || adjustedX >= glyphSizeX)) {
+                    continue;
+                }
+                adjustedX = inRange(adjustedX, 0, renderContext.atlasGlyphSize.x - 1);
+                int adjustedY = inRange(y + renderContext.lineSpacing + renderContext.maxBelowBaseline - yOffset, 0, renderContext.atlasGlyphSize.y - 1);
+                unsigned char value = bitmap->buffer[(bitmapHeight - y - 1) * bitmapWidth + x];
+                if (value > (unsigned char) flippedBitmap[adjustedY * glyphSizeX + adjustedX]) {
+                    flippedBitmap[adjustedY * glyphSizeX + adjustedX] = value;
+                }
+            }
         }
+        penX += (int) face->glyph->advance.x >> 6;
     }
 
     glBindTexture(GL_TEXTURE_2D, renderContext.atlasTextureId);
@@ -203,94 +196,288 @@ void loadBaselineFont(char *fontPath) {
     printf("\n");
 }
 
+static void markGlyphDirty(int id) {
+    for (int slot = 0; slot < SHADER_CONTEXT_SLOTS; slot++) {
+        if (dirtyStart[slot] == dirtyEnd[slot]) {
+            dirtyStart[slot] = id;
+            dirtyEnd[slot] = id + 1;
+        } else {
+            if (id < dirtyStart[slot]) dirtyStart[slot] = id;
+            if (id >= dirtyEnd[slot]) dirtyEnd[slot] = id + 1;
+        }
+    }
+}
+
+static unsigned int hashKey(unsigned int key) {
+    return (key * 0x9E3779B1u) % GLYPH_HASH_SIZE;
+}
+
+static unsigned int findKey(unsigned int key) {
+    unsigned int slot = hashKey(key);
+    while (glyphTable[slot] != 0 && glyphKeys[glyphTable[slot]] != key) {
+        slot = (slot + 1) % GLYPH_HASH_SIZE;
+    }
+    return slot;
+}
+
 /**
- * Moves an entry to the front of the LRU cache, marking it as the
- * most recently used entry.
+ * Empties a slot of the hash table, moving later ids of the probe sequence back so that lookups never stop early
+ * at the hole.
 */
-void markGlyphAsUsed(struct GlyphEntry *entry) {
-    if (entry == lruStart) {
+static void removeKey(unsigned int hole) {
+    for (unsigned int slot = (hole + 1) % GLYPH_HASH_SIZE; glyphTable[slot] != 0; slot = (slot + 1) % GLYPH_HASH_SIZE) {
+        const unsigned int home = hashKey(glyphKeys[glyphTable[slot]]);
+        const int between = hole < slot ? home > hole && home <= slot : home > hole || home <= slot;
+        if (!between) {
+            glyphTable[hole] = glyphTable[slot];
+            hole = slot;
+        }
+    }
+    glyphTable[hole] = 0;
+}
+
+static void unlinkSlot(int slot) {
+    if (slots[slot].previous >= 0) slots[slots[slot].previous].next = slots[slot].next; else lruFirst = slots[slot].next;
+    if (slots[slot].next >= 0) slots[slots[slot].next].previous = slots[slot].previous; else lruLast = slots[slot].previous;
+}
+
+/**
+ * Moves an atlas position to the front of the LRU list, marking it as the most recently used position.
+*/
+static void touchSlot(int slot) {
+    if (slot == lruFirst) {
         return;
     }
+    unlinkSlot(slot);
+    slots[slot].previous = -1;
+    slots[slot].next = lruFirst;
+    slots[lruFirst].previous = slot;
+    lruFirst = slot;
+}
+
+/**
+ * Whether an atlas position may still be drawn by a frame the GPU has not finished. The screen shown from a scan
+ * until the next one is what that scan found, so a position last seen by scan k is in use until the frame of scan
+ * k + 1, and the last SHADER_CONTEXT_SLOTS frames may be in flight.
+*/
+static int isSlotPinned(int slot) {
+    const int scan = slots[slot].scan;
+    if (scan == scanIndex) {
+        return 1;
+    }
+    if (scanIndex - scan >= SHADER_CONTEXT_SLOTS) {
+        return 0;
+    }
+    return scanFrames[(scan + 1) % SHADER_CONTEXT_SLOTS] > frame - SHADER_CONTEXT_SLOTS + 1;
+}
+
+/**
+ * Frees an id whose key will not be drawn again. Its atlas position keeps its pixels and its place in the LRU
+ * list, since frames in flight may still draw it.
+*/
+static void freeGlyph(int id, unsigned int hashSlot) {
+    removeKey(hashSlot);
+    if (glyphSlots[id] != ATLAS_SLOT_BLANK) {
+        slots[glyphSlots[id]].glyph = -1;
+        glyphSlots[id] = ATLAS_SLOT_BLANK;
+    }
+    freeIds[freeCount++] = id;
+    glyphCount--;
+}
 
-    if (lruEnd == entry) {
-        lruEnd = entry->previousLRUEntry;
+void initGlyphCache() {
+    for (int id = 0; id < GLYPH_FIXED_IDS; id++) {
+        glyphKeys[id] = id;
+    }
+    memset(glyphTable, 0, sizeof(glyphTable));
+    memset(glyphSlots, 0, sizeof(glyphSlots));
+    nextId = GLYPH_FIXED_IDS;
+    freeCount = 0;
+    glyphCount = GLYPH_FIXED_IDS;
+
+    for (int slot = 0; slot < ATLAS_SLOTS; slot++) {
+        slots[slot] = (struct AtlasSlot) {
+            .glyph = -1,
+            .scan = -SHADER_CONTEXT_SLOTS,
+            .previous = slot - 1,
+            .next = slot + 1 < ATLAS_SLOTS ? slot + 1 : -1
+        };
     }
+    // The blank position is never handed out.
+    slots[1].previous = -1;
+    lruFirst = 1;
+    lruLast = ATLAS_SLOTS - 1;
+    invalidateShaderGlyphs();
+}
 
-    entry->previousLRUEntry = 0;
-    entry->nextLRUEntry = lruStart;
-    lruStart->previousLRUEntry = entry;
-    lruStart = entry;
+void freeGlyphCache() {
+    free(scannedRows);
+    scannedRows = 0;
+    scannedRowCount = 0;
 }
 
-void removeCacheEntry(int codePoint) {
-    int hash = fnvHash10(codePoint);
-    struct GlyphEntry *currentEntry = glyphCache[hash];
-    if (currentEntry && currentEntry->codePoint == codePoint) {
-        glyphCache[hash] = currentEntry->nextCacheEntry;
+/**
+ * Returns the id of a glyph key, adding it the first time it is seen. Once every id is taken, new glyphs are blank
+ * until unused ids are collected.
+*/
+int internGlyph(unsigned int key) {
+    const unsigned int slot = findKey(key);
+    if (glyphTable[slot] != 0) {
+        return glyphTable[slot];
+    }
+
+    int id;
+    if (freeCount > 0) {
+        id = freeIds[--freeCount];
+    } else if (nextId < GLYPH_TABLE_SIZE) {
+        id = nextId++;
     } else {
-        struct GlyphEntry *prevEntry = glyphCache[hash];
-        while (currentEntry && currentEntry->codePoint != codePoint) {
-            prevEntry = currentEntry;
-            currentEntry = currentEntry->nextCacheEntry;
-        }
-        if (currentEntry && currentEntry->codePoint == codePoint) {
-            prevEntry->nextCacheEntry = currentEntry->nextCacheEntry;
-        } else {
-            printf("failed to find entry for codePoint %x\n", codePoint);
-        }
+        collectAt = glyphCount;
+        return GLYPH_BLANK;
     }
+
+    glyphKeys[id] = key;
+    glyphSlots[id] = ATLAS_SLOT_BLANK;
+    glyphTable[slot] = id;
+    glyphCount++;
+    markGlyphDirty(id);
+    return id;
 }
 
-void insertCacheEntry(struct GlyphEntry *entry, int hash) {
-    if (glyphCache[hash] == 0) {
-        glyphCache[hash] = entry;
-    } else {
-        struct GlyphEntry *currentEntry = glyphCache[hash];
-        while (currentEntry->nextCacheEntry) {
-            currentEntry = currentEntry->nextCacheEntry;
+unsigned int getGlyphKey(int id) {
+    return glyphKeys[id];
+}
+
+/**
+ * Frees the id of a key before the key is reused for a different glyph, as cluster ids are once the cluster is
+ * collected. No cell may still refer to the id.
+*/
+void forgetGlyph(unsigned int key) {
+    const unsigned int slot = findKey(key);
+    if (glyphTable[slot] != 0) {
+        freeGlyph(glyphTable[slot], slot);
+    }
+}
+
+/**
+ * Frees the ids that no cell of the grid refers to. Rows that scroll into the history store their glyph keys
+ * rather than ids, so a sweep of the grid is enough to find every id in use. Frames in flight keep their own copy
+ * of the id table, so ids can be reused right away.
+*/
+static void collectGlyphs() {
+    static unsigned char used[GLYPH_TABLE_SIZE];
+    memset(used, 0, sizeof(used));
+
+    const struct CellGrid *grid = renderContext.grid;
+    for (int row = 0; grid && row < grid->rows; row++) {
+        const unsigned int *cells = &grid->cells[row * grid->columns];
+        for (int x = 0; x < grid->blankFrom[row]; x++) {
+            used[(cells[x] >> CELL_GLYPH_SHIFT) & CELL_GLYPH_MASK] = 1;
         }
-        currentEntry->nextCacheEntry = entry;
     }
+
+    for (int id = GLYPH_FIXED_IDS; id < nextId; id++) {
+        if (used[id]) {
+            continue;
+        }
+        const unsigned int slot = findKey(glyphKeys[id]);
+        if (glyphTable[slot] == id) {
+            freeGlyph(id, slot);
+        }
+    }
+    // Collect again only once half of the remaining ids are taken.
+    collectAt = glyphCount + (GLYPH_TABLE_SIZE - glyphCount) / 2;
 }
 
-struct GlyphEntry* addGlyphToCache(int codePoint, int hash) {
-    // Remove end of LRU chain and remove entry from cache
-    struct GlyphEntry *deletedEntry = lruEnd;
-    lruEnd->previousLRUEntry->nextLRUEntry = 0;
-    lruEnd = lruEnd->previousLRUEntry;
-    removeCacheEntry(deletedEntry->codePoint);
-
-    addCodePointToAtlas(codePoint, deletedEntry->atlasPosition);
-
-    // Create new entry, occupies the same atlas position as deleted entry
-    struct GlyphEntry *newEntry = deletedEntry;
-    newEntry->codePoint = codePoint;
-    newEntry->previousLRUEntry = 0;
-    newEntry->nextLRUEntry = 0;
-    newEntry->nextCacheEntry = 0;
-
-    // Place new entry at front of LRU chain
-    newEntry->nextLRUEntry = lruStart;
-    lruStart->previousLRUEntry = newEntry;
-    lruStart = newEntry;
-
-    // Insert new entry into table
-    insertCacheEntry(newEntry, hash);
-    return newEntry;
+/**
+ * Renders a glyph to the least recently used atlas position that no frame in flight may draw. Leaves the glyph
+ * blank and tries again at the next frame when every position is in use.
+*/
+static void resolveGlyph(int id) {
+    const int slot = lruLast;
+    if (isSlotPinned(slot)) {
+        rescan = 1;
+        return;
+    }
+
+    if (slots[slot].glyph >= 0) {
+        glyphSlots[slots[slot].glyph] = ATLAS_SLOT_BLANK;
+        markGlyphDirty(slots[slot].glyph);
+    }
+    addCodePointToAtlas(glyphKeys[id], slot);
+    slots[slot].glyph = id;
+    glyphSlots[id] = slot;
+    markGlyphDirty(id);
 }
 
-int getGlyphAtlasPosition(unsigned int codePoint) {
-    int hash = fnvHash10(codePoint);
+/**
+ * Gives every glyph on screen an atlas position and pins the positions, see isSlotPinned(). Only runs when the
+ * visible rows or their cells have changed since the last scan.
+*/
+static void scanVisibleGlyphs() {
+    const struct CellGrid *grid = renderContext.grid;
+    const struct ShaderRow *rows = renderContext.shaderRowMap;
+    const int rowCount = renderContext.screenTileSize.y;
+    const int changed = rescan || grid->dirtyRowCount[renderContext.shaderContextSlot] > 0 || rowCount != scannedRowCount
+        || memcmp(rows, scannedRows, rowCount * sizeof(struct ShaderRow)) != 0;
+    if (!changed) {
+        return;
+    }
+    if (rowCount != scannedRowCount) {
+        scannedRows = realloc(scannedRows, rowCount * sizeof(struct ShaderRow));
+        scannedRowCount = rowCount;
+    }
+    memcpy(scannedRows, rows, rowCount * sizeof(struct ShaderRow));
+
+    rescan = 0;
+    scanIndex++;
+    scanFrames[scanIndex % SHADER_CONTEXT_SLOTS] = frame;
+    const int columns = renderContext.screenTileSize.x < grid->columns ? renderContext.screenTileSize.x : grid->columns;
+    for (int y = 0; y < rowCount; y++) {
+        const unsigned int *cells = &grid->cells[rows[y].row * grid->columns];
+        const int end = rows[y].blankFrom < columns ? rows[y].blankFrom : columns;
+        for (int x = 0; x < end; x++) {
+            const int id = (cells[x] >> CELL_GLYPH_SHIFT) & CELL_GLYPH_MASK;
+            if (glyphSlots[id] == ATLAS_SLOT_BLANK) {
+                // Blank and space draw nothing, so they never take a position.
+                if (id == GLYPH_BLANK || id == ' ') continue;
+                resolveGlyph(id);
+                if (glyphSlots[id] == ATLAS_SLOT_BLANK) continue;
+            }
+            const int slot = glyphSlots[id];
+            if (slots[slot].scan != scanIndex) {
+                slots[slot].scan = scanIndex;
+                touchSlot(slot);
+            }
+        }
+    }
+}
 
-    struct GlyphEntry *currentEntry = glyphCache[hash];
-    while (currentEntry && currentEntry->codePoint != codePoint) {
-        currentEntry = currentEntry->nextCacheEntry;
+/**
+ * Marks every glyph id as changed, so that the whole table is written to each slot of a new shader context.
+*/
+void invalidateShaderGlyphs() {
+    for (int slot = 0; slot < SHADER_CONTEXT_SLOTS; slot++) {
+        dirtyStart[slot] = 0;
+        dirtyEnd[slot] = nextId;
     }
+}
 
-    if (!currentEntry || codePoint != currentEntry->codePoint) {
-        currentEntry = addGlyphToCache(codePoint, hash);
+/**
+ * Resolves the atlas positions of the visible glyphs and writes the positions that changed since the current
+ * shader context slot was last written. Runs once per frame after the row map is updated and before the grid is
+ * uploaded, while the grid still lists the rows that changed.
+*/
+void updateShaderGlyphs() {
+    frame++;
+    if (glyphCount >= collectAt) {
+        collectGlyphs();
     }
+    scanVisibleGlyphs();
 
-    markGlyphAsUsed(currentEntry);
-    return currentEntry->atlasPosition;
+    const int slot = renderContext.shaderContextSlot;
+    for (int id = dirtyStart[slot]; id < dirtyEnd[slot]; id++) {
+        renderContext.shaderContext->glyphSlots[id] = glyphSlots[id];
+    }
+    dirtyStart[slot] = dirtyEnd[slot] = 0;
 }
@@ -1,8 +1,38 @@
 #pragma once
 
+#include "cell.h"
+
+/**
+ * Cells refer to glyphs by id. A glyph's key is the codepoint or cluster it draws, with a flag for each half of a
+ * double-width glyph. Ids below GLYPH_FIXED_IDS are the ASCII codepoints themselves and are never looked up, other
+ * keys are interned as they are printed. The atlas position of each id is resolved once per frame for the glyphs
+ * on screen and passed to the shader in a table indexed by id, so positions can be recycled without changing cells.
+*/
+#define GLYPH_TABLE_SIZE (CELL_GLYPH_MASK + 1)
+#define GLYPH_FIXED_IDS 0x80
+#define GLYPH_BLANK 0
+
+/**
+ * Flags of keys selecting one half of a double-width glyph. Each half is rendered to its own atlas tile, so the
+ * two cells of a wide character are drawn like any other cells.
+*/
+#define GLYPH_LEFT_HALF (1 << 24)
+#define GLYPH_RIGHT_HALF (1 << 25)
+// Keys with this flag draw the grapheme cluster with the id in the codepoint bits, see cluster.h.
+#define GLYPH_CLUSTER (1 << 26)
+#define GLYPH_CODEPOINT_MASK 0x1FFFFF
+
 struct Vec2i8 { unsigned char x; unsigned char y; };
 
 void initGlyphCache();
 void freeGlyphCache();
 void loadBaselineFont(char *fontPath);
-int getGlyphAtlasPosition(unsigned int codePoint);
+int internGlyph(unsigned int key);
+unsigned int getGlyphKey(int id);
+void forgetGlyph(unsigned int key);
+void invalidateShaderGlyphs();
+void updateShaderGlyphs();
+
+static inline int getGlyphId(unsigned int key) {
+    return key < GLYPH_FIXED_IDS ? (int) key : internGlyph(key);
+}
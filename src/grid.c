@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+#include "grid.h"
+
+extern struct RenderContext renderContext;
+
+/**
+ * Allocates a grid where every row is erased to blank cells with default colors, so nothing needs to be copied to
+ * the shader context until rows are written.
+*/
+struct CellGrid *createGrid(int columns, int rows) {
+    struct CellGrid *grid = calloc(1, sizeof(struct CellGrid));
+    grid->columns = columns;
+    grid->rows = rows;
+    grid->cells = calloc((size_t) columns * rows, sizeof(unsigned int));
+    grid->blankFrom = calloc(rows, sizeof(int));
+    grid->blankCell = calloc(rows, sizeof(unsigned int));
+    grid->wrapped = calloc(rows, 1);
+
+    for (int set = 0; set < SHADER_CONTEXT_SLOTS; set++) {
+        grid->dirtyStart[set] = calloc(rows, sizeof(int));
+        grid->dirtyEnd[set] = calloc(rows, sizeof(int));
+        grid->dirtyRows[set] = malloc(rows * sizeof(int));
+    }
+    grid->dirtySets = SHADER_CONTEXT_SLOTS;
+    return grid;
+}
+
+/**
+ * Starts keeping the frame differ's set of dirty columns, which is only needed once something diffs frames of the
+ * grid. Cells written before are not in the set, so the first diff must compare every row.
+*/
+void trackFrameDiff(struct CellGrid *grid) {
+    if (grid->dirtySets > GRID_FRAME_DIFF_SET) {
+        return;
+    }
+    grid->dirtyStart[GRID_FRAME_DIFF_SET] = calloc(grid->rows, sizeof(int));
+    grid->dirtyEnd[GRID_FRAME_DIFF_SET] = calloc(grid->rows, sizeof(int));
+    grid->dirtyRows[GRID_FRAME_DIFF_SET] = malloc(grid->rows * sizeof(int));
+    grid->dirtySets = GRID_DIRTY_SETS;
+}
+
+void freeGrid(struct CellGrid *grid) {
+    if (!grid) {
+        return;
+    }
+
+    for (int set = 0; set < GRID_DIRTY_SETS; set++) {
+        free(grid->dirtyStart[set]);
+        free(grid->dirtyEnd[set]);
+        free(grid->dirtyRows[set]);
+    }
+    free(grid->cells);
+    free(grid->blankFrom);
+    free(grid->blankCell);
+    free(grid->wrapped);
+    free(grid);
+}
+
+/**
+ * Records that columns [xStart, xEnd) of the storage row have changed and must be copied to every slot of the
+ * shader context ring, and compared by the frame differ if it is tracked.
+*/
+void markCellsDirty(int row, int xStart, int xEnd) {
+    // An empty range would leave the row looking clean, and listing it again would overrun the dirty row list.
+    if (xStart >= xEnd) {
+        return;
+    }
+
+    struct CellGrid *grid = renderContext.grid;
+    for (int set = 0; set < grid->dirtySets; set++) {
+        int *dirtyStart = grid->dirtyStart[set];
+        int *dirtyEnd = grid->dirtyEnd[set];
+        if (dirtyStart[row] == dirtyEnd[row]) {
+            grid->dirtyRows[set][grid->dirtyRowCount[set]++] = row;
+            dirtyStart[row] = xStart;
+            dirtyEnd[row] = xEnd;
+            continue;
+        }
+
+        if (xStart < dirtyStart[row]) dirtyStart[row] = xStart;
+        if (xEnd > dirtyEnd[row]) dirtyEnd[row] = xEnd;
+    }
+}
+
+/**
+ * Writes the row's blank cell into columns [xStart, xEnd) of its erased cells.
+*/
+static void fillBlankCells(int row, int xStart, int xEnd) {
+    struct CellGrid *grid = renderContext.grid;
+    unsigned int *cells = &grid->cells[row * grid->columns];
+    const unsigned int blank = grid->blankCell[row];
+    if (blank == 0) {
+        memset(cells + xStart, 0, (xEnd - xStart) * sizeof(unsigned int));
+    } else {
+        for (int x = xStart; x < xEnd; x++) {
+            cells[x] = blank;
+        }
+    }
+    markCellsDirty(row, xStart, xEnd);
+}
+
+/**
+ * Erases columns [x, end of row) to `blank` cells without writing them. The shader draws these cells from the row
+ * map, so they are only filled in when something is written over them. Erasing a whole row or the rest of a line
+ * costs the same however wide the grid is.
+*/
+void clearCells(int row, int x, unsigned int blank) {
+    struct CellGrid *grid = renderContext.grid;
+    grid->wrapped[row] = 0;
+    if (grid->blankFrom[row] <= x) {
+        if (grid->blankCell[row] == blank) {
+            return;
+        }
+        // The cells before x keep the old blank.
+        fillBlankCells(row, grid->blankFrom[row], x);
+    }
+
+    grid->blankFrom[row] = x;
+    grid->blankCell[row] = blank;
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+}
+
+/**
+ * Returns the cells of a row for writing columns [0, xEnd). Erased cells in that range are filled in first, while
+ * the cells after it stay erased.
+*/
+unsigned int *getWritableRow(int row, int xEnd) {
+    struct CellGrid *grid = renderContext.grid;
+    if (grid->blankFrom[row] < xEnd) {
+        fillBlankCells(row, grid->blankFrom[row], xEnd);
+        grid->blankFrom[row] = xEnd;
+        renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+    }
+    return &grid->cells[row * grid->columns];
+}
+
+/**
+ * Returns the row map entry that tells the shader where to find a row and where its erased cells start.
+*/
+struct ShaderRow getShaderRow(int row) {
+    const struct CellGrid *grid = renderContext.grid;
+    return (struct ShaderRow) {
+        .row = row,
+        .blankFrom = grid->blankFrom[row],
+        .blank = grid->blankCell[row]
+    };
+}
+
+/**
+ * Copies the columns that changed since the current shader context slot was last written. Erased cells are skipped,
+ * since the shader does not read them. A frame that changes a single cell writes 4 bytes to the slot.
+*/
+void uploadGrid() {
+    struct CellGrid *grid = renderContext.grid;
+    struct TextShaderContext *shaderContext = renderContext.shaderContext;
+    const int slot = renderContext.shaderContextSlot;
+    int *dirtyStart = grid->dirtyStart[slot];
+    int *dirtyEnd = grid->dirtyEnd[slot];
+
+    for (int i = 0; i < grid->dirtyRowCount[slot]; i++) {
+        const int row = grid->dirtyRows[slot][i];
+        const int start = row * grid->columns + dirtyStart[row];
+        const int end = dirtyEnd[row] < grid->blankFrom[row] ? dirtyEnd[row] : grid->blankFrom[row];
+        if (end > dirtyStart[row]) {
+            memcpy(&shaderContext->cells[start], &grid->cells[start], (end - dirtyStart[row]) * sizeof(unsigned int));
+        }
+        dirtyStart[row] = dirtyEnd[row] = 0;
+    }
+    grid->dirtyRowCount[slot] = 0;
+}
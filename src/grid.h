@@ -0,0 +1,10 @@
+#pragma once
+
+struct CellGrid *createGrid(int columns, int rows);
+void freeGrid(struct CellGrid *grid);
+void trackFrameDiff(struct CellGrid *grid);
+void markCellsDirty(int row, int xStart, int xEnd);
+void clearCells(int row, int x, unsigned int blank);
+unsigned int *getWritableRow(int row, int xEnd);
+struct ShaderRow getShaderRow(int row);
+void uploadGrid();
@@ -0,0 +1,1093 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "terminal.h"
+#include "history.h"
+#include "cluster.h"
+#include "colors.h"
+#include "glyph.h"
+#include "hyperlink.h"
+#include "width.h"
+
+// Rows collected in the open block before it is compressed.
+#define HISTORY_BLOCK_ROWS 256
+// Compressed bytes kept, mostly in the spill file, before the oldest blocks are dropped.
+#define HISTORY_MAX_SIZE (512 * 1024 * 1024)
+// Newest compressed blocks kept in memory. Older blocks are written to the spill file.
+#define HISTORY_RESIDENT_BLOCKS 32
+// Largest encoded size of a cell: a run length, a style and a glyph, each as a varint.
+#define ENCODED_CELL_SIZE 12
+// Glyphs are stored as codepoints. Values past the last codepoint stand for the right half of the wide character
+// before them, and for a cluster of as many codepoints as the value is past HISTORY_CLUSTER, stored after it.
+#define HISTORY_SPACER 0x110000
+#define HISTORY_CLUSTER 0x110001
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+#define COMPRESSED_SIZE_BOUND(length) ((length) + (length) / 255 + 16)
+
+/**
+ * A block of HISTORY_BLOCK_ROWS encoded rows, compressed as a whole so that repeated text across lines is found.
+ * Blocks that were spilled have no data in memory, only their offset in the spill file.
+*/
+struct HistoryBlock {
+    unsigned char *data;
+    long long fileOffset;
+    // Blocks are numbered as they are closed, so a snapshot can tell the blocks it has already saved, see snapshot.h.
+    long long serial;
+    int size;
+    int rawSize;
+};
+
+/**
+ * Rows that scrolled out of the grid, oldest first. Every row added gets the next id, and rows keep their id when
+ * older blocks are dropped, so ids can be cached by readers.
+*/
+struct History {
+    struct HistoryBlock *blocks;
+    int blockCount;
+    int blockCapacity;
+    long long nextSerial;
+    long long compressedSize;
+    // Id of the first row of the oldest block.
+    long long start;
+    // Encoded rows that have not been compressed yet.
+    unsigned char *open;
+    int openSize;
+    int openCapacity;
+    int openRows;
+    // Offset of each row's size prefix in the open block and in the cached block.
+    int openOffsets[HISTORY_BLOCK_ROWS];
+    // Most recently decompressed block, identified by the id of its first row.
+    unsigned char *cache;
+    int cacheCapacity;
+    long long cacheStart;
+    int cacheOffsets[HISTORY_BLOCK_ROWS];
+    // Unlinked temporary file holding the spilled blocks, so that the history of a long session is paged in from
+    // disk as it is scrolled back instead of staying in memory. -1 until the first block is spilled.
+    int spillFd;
+    int spillFailed;
+    long long spillSize;
+};
+
+static struct History history = { .cacheStart = -1, .spillFd = -1 };
+static unsigned char *scratch;
+static int scratchCapacity;
+
+static int writeVarint(unsigned char *output, unsigned int value) {
+    int length = 0;
+    while (value >= 0x80) {
+        output[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    output[length++] = value;
+    return length;
+}
+
+static unsigned int readVarint(const unsigned char **input) {
+    unsigned int value = 0;
+    int shift = 0;
+    while (**input & 0x80) {
+        value |= (unsigned int) (*(*input)++ & 0x7F) << shift;
+        shift += 7;
+    }
+    return value | (unsigned int) *(*input)++ << shift;
+}
+
+/**
+ * Writes the 24-bit color of the palette entry at `shift` in a style, if it is one, and returns the bytes written.
+*/
+static int writeTrueColor(unsigned char *output, unsigned int style, int shift) {
+    const int index = (style >> shift) & STYLE_COLOR_MASK;
+    return index >= PALETTE_TRUECOLOR_BASE ? writeVarint(output, getPaletteColor(index)) : 0;
+}
+
+/**
+ * Reads the 24-bit color written by writeTrueColor() for the color at `shift` in a style, and returns the style
+ * with the color's entry in the current palette.
+*/
+static unsigned int readTrueColor(const unsigned char **input, unsigned int style, int shift) {
+    if (((style >> shift) & STYLE_COLOR_MASK) < PALETTE_TRUECOLOR_BASE) {
+        return style;
+    }
+    const int color = readVarint(input);
+    const int index = getTrueColorIndex(color >> 16, color >> 8, color);
+    return (style & ~((unsigned int) STYLE_COLOR_MASK << shift)) | ((unsigned int) index << shift);
+}
+
+/**
+ * Encodes the cell count and wrap flag, then runs of cells sharing a style, then the glyph of each cell. Splitting
+ * the styles from the glyphs turns a line in a single color into one run followed by its text. Styles are stored
+ * by value rather than by id, since ids are reused once no cell in the grid refers to them, and so are the 24-bit
+ * colors they refer to.
+*/
+int encodeHistoryRow(const unsigned int *cells, int length, int wrapped, unsigned char *output) {
+    int size = writeVarint(output, (length << 1) | (wrapped ? 1 : 0));
+
+    for (int x = 0; x < length;) {
+        const unsigned int style = cells[x] >> CELL_STYLE_SHIFT;
+        int run = 1;
+        while (x + run < length && cells[x + run] >> CELL_STYLE_SHIFT == style) run++;
+        size += writeVarint(output + size, run);
+        size += writeVarint(output + size, getStyle(style));
+        // Palette entries of 24-bit colors are reused too, so the colors are stored with the run.
+        size += writeTrueColor(output + size, getStyle(style), STYLE_FOREGROUND_SHIFT);
+        size += writeTrueColor(output + size, getStyle(style), STYLE_BACKGROUND_SHIFT);
+        // Link ids are reused once the grid no longer shows them, so the link itself is stored with the run.
+        const int link = getStyleLink(getStyle(style));
+        if (link != HYPERLINK_NONE) {
+            const char *key;
+            const int keyLength = getHyperlinkKey(link, &key);
+            size += writeVarint(output + size, keyLength);
+            memcpy(output + size, key, keyLength);
+            size += keyLength;
+        }
+        x += run;
+    }
+
+    // Glyph ids are reused once the grid no longer shows them, so the codepoints of each glyph are stored instead.
+    for (int x = 0; x < length; x++) {
+        if (cells[x] & CELL_SPACER) {
+            size += writeVarint(output + size, HISTORY_SPACER);
+            continue;
+        }
+        const unsigned int key = getGlyphKey((cells[x] >> CELL_GLYPH_SHIFT) & CELL_GLYPH_MASK);
+        if (!(key & GLYPH_CLUSTER)) {
+            size += writeVarint(output + size, key & GLYPH_CODEPOINT_MASK);
+            continue;
+        }
+        const int *codePoints;
+        const int count = getClusterCodePoints(key & GLYPH_CODEPOINT_MASK, &codePoints);
+        size += writeVarint(output + size, HISTORY_CLUSTER + count);
+        for (int i = 0; i < count; i++) {
+            size += writeVarint(output + size, codePoints[i]);
+        }
+    }
+    return size;
+}
+
+/**
+ * Decodes cells [from, from + count) of a row written by encodeHistoryRow(), blanking the cells past the end of the
+ * row.
+*/
+void decodeHistoryRow(const unsigned char *input, int from, unsigned int *cells, int count) {
+    const int length = readVarint(&input) >> 1;
+    const int end = from + count < length ? from + count : length;
+    for (int x = 0; x < length;) {
+        const int run = readVarint(&input);
+        unsigned int value = readVarint(&input);
+        value = readTrueColor(&input, value, STYLE_FOREGROUND_SHIFT);
+        value = readTrueColor(&input, value, STYLE_BACKGROUND_SHIFT);
+        int link = HYPERLINK_NONE;
+        if (getStyleLink(value) != HYPERLINK_NONE) {
+            const int keyLength = readVarint(&input);
+            link = internHyperlink((const char *) input, keyLength);
+            input += keyLength;
+            value = (value & ~((unsigned int) STYLE_LINK_MASK << STYLE_LINK_SHIFT)) | ((unsigned int) link << STYLE_LINK_SHIFT);
+        }
+        const unsigned int style = packCell(0, internStyle(value));
+        releaseHyperlink(link);
+        for (int i = 0; i < run; i++, x++) {
+            if (x >= from && x < end) cells[x - from] = style;
+        }
+    }
+
+    unsigned int previous = 0;
+    for (int x = 0; x < end; x++) {
+        const unsigned int value = readVarint(&input);
+        unsigned int key = value;
+        if (value > HISTORY_SPACER) {
+            int codePoints[CLUSTER_MAX_LENGTH];
+            const int count = value - HISTORY_CLUSTER;
+            for (int i = 0; i < count; i++) {
+                codePoints[i] = readVarint(&input);
+            }
+            key = GLYPH_CLUSTER | internCluster(codePoints, count);
+            if (getCodepointWidth(codePoints[0]) == 2) key |= GLYPH_LEFT_HALF;
+        } else if (value == HISTORY_SPACER) {
+            key = previous & GLYPH_LEFT_HALF ? (previous & ~GLYPH_LEFT_HALF) | GLYPH_RIGHT_HALF : 0;
+        } else if (getCodepointWidth(value) == 2) {
+            key |= GLYPH_LEFT_HALF;
+        }
+        previous = key;
+        if (x < from || key == 0) continue;
+
+        unsigned int cell = getGlyphId(key) << CELL_GLYPH_SHIFT;
+        if (key & GLYPH_LEFT_HALF) cell |= CELL_WIDE;
+        if (key & GLYPH_RIGHT_HALF) cell |= CELL_SPACER;
+        cells[x - from] |= cell;
+    }
+
+    for (int x = end > from ? end - from : 0; x < count; x++) {
+        cells[x] = 0;
+    }
+}
+
+static int writeLength(unsigned char *output, int length) {
+    int size = 0;
+    for (; length >= 255; length -= 255) {
+        output[size++] = 255;
+    }
+    output[size++] = length;
+    return size;
+}
+
+static int readLength(const unsigned char **input) {
+    int length = 0;
+    unsigned char byte;
+    do {
+        byte = *(*input)++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+/**
+ * Writes a token holding both lengths, the literals, then the match offset. A match length of 0 ends the block.
+*/
+static int writeSequence(unsigned char *output, const unsigned char *literals, int literalLength, int offset, int matchLength) {
+    unsigned char *token = output;
+    int size = 1;
+    *token = (literalLength < 15 ? literalLength : 15) << 4;
+    if (literalLength >= 15) size += writeLength(output + size, literalLength - 15);
+    memcpy(output + size, literals, literalLength);
+    size += literalLength;
+
+    if (matchLength > 0) {
+        output[size++] = offset & 0xFF;
+        output[size++] = offset >> 8;
+        const int extraLength = matchLength - LZ_MIN_MATCH;
+        *token |= extraLength < 15 ? extraLength : 15;
+        if (extraLength >= 15) size += writeLength(output + size, extraLength - 15);
+    }
+    return size;
+}
+
+static unsigned int read32(const unsigned char *input) {
+    unsigned int value;
+    memcpy(&value, input, sizeof(value));
+    return value;
+}
+
+/**
+ * LZ77 compression in the style of LZ4: a single hash table probe per position, no entropy coding. Runs of blank
+ * cells become matches at a short offset. `output` must hold COMPRESSED_SIZE_BOUND(length) bytes.
+*/
+static int compressBlock(const unsigned char *input, int length, unsigned char *output) {
+    int table[1 << LZ_HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    int size = 0;
+    int anchor = 0;
+    int i = 0;
+    while (i + LZ_MIN_MATCH <= length) {
+        const unsigned int sequence = read32(input + i);
+        const unsigned int hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        const int candidate = table[hash];
+        table[hash] = i;
+        if (candidate < 0 || i - candidate > LZ_MAX_OFFSET || read32(input + candidate) != sequence) {
+            i++;
+            continue;
+        }
+
+        int matchLength = LZ_MIN_MATCH;
+        while (i + matchLength < length && input[candidate + matchLength] == input[i + matchLength]) {
+            matchLength++;
+        }
+        size += writeSequence(output + size, input + anchor, i - anchor, i - candidate, matchLength);
+        i += matchLength;
+        anchor = i;
+    }
+    size += writeSequence(output + size, input + anchor, length - anchor, 0, 0);
+    return size;
+}
+
+static void decompressBlock(const unsigned char *input, int size, unsigned char *output) {
+    const unsigned char *end = input + size;
+    int o = 0;
+    while (input < end) {
+        const int token = *input++;
+        int literalLength = token >> 4;
+        if (literalLength == 15) literalLength += readLength(&input);
+        memcpy(output + o, input, literalLength);
+        input += literalLength;
+        o += literalLength;
+        if (input >= end) {
+            break;
+        }
+
+        const int offset = input[0] | (input[1] << 8);
+        input += 2;
+        int matchLength = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15) matchLength += readLength(&input);
+        // Byte by byte, since a match may overlap the bytes it produces.
+        for (int i = 0; i < matchLength; i++, o++) {
+            output[o] = output[o - offset];
+        }
+    }
+}
+
+/**
+ * A logical line of the history: a row and the rows it wrapped onto, as laid out at the width the history is viewed
+ * at. Its display rows have coordinates [displayStart, displayStart + displayRows).
+*/
+struct HistoryLine {
+    long long firstRow;
+    long long length;
+    int displayRows;
+    // Cells on the last display row, and whether a wide character moved to the next row.
+    int lastRowCells;
+    int moved;
+    long long displayStart;
+};
+
+/**
+ * The history's lines at the width it is viewed at, which may differ from the widths its rows were written at. Only
+ * the lines from `indexedFrom` to the end of the history are indexed, back as far as the history has been scrolled,
+ * so a resize only has to discard the index. Display row coordinates stay the same as lines are added to either end,
+ * and every rebuild of the index starts from a new origin, so readers can cache rows by coordinate.
+*/
+struct HistoryView {
+    int columns;
+    // Lines oldest first, in lines[first, first + count).
+    struct HistoryLine *lines;
+    int first;
+    int count;
+    int capacity;
+    long long indexedFrom;
+    long long origin;
+    // Whether the newest row wrapped, so that the next row continues its line.
+    int lastWrapped;
+};
+
+static struct HistoryView view;
+
+/**
+ * Progress laying out the cells of a line on rows of `columns` cells. As when printing, a wide character that does
+ * not fit in the last column of a row moves to the next row, so rows may end a cell early. If `find` is not
+ * negative, the offsets in the line of the display rows `find` and `find + 1` are recorded in `found` once reached.
+*/
+struct LineLayout {
+    int columns;
+    long long cells;
+    int rows;
+    int lastRowCells;
+    int moved;
+    int find;
+    long long found[2];
+};
+
+static void findLayoutRows(struct LineLayout *layout) {
+    if (layout->find < 0) return;
+    for (int i = 0; i < 2; i++) {
+        const int row = layout->find + i;
+        if (layout->found[i] < 0 && layout->rows - 1 >= row) {
+            // Rows started by a single run of narrow cells are full.
+            const long long rowStart = layout->cells - layout->lastRowCells;
+            layout->found[i] = rowStart - (long long) (layout->rows - 1 - row) * layout->columns;
+        }
+    }
+}
+
+static struct LineLayout startLayout(const struct HistoryLine *line, int columns, int find) {
+    struct LineLayout layout = { .columns = columns, .rows = 1, .find = find, .found = { -1, -1 } };
+    if (line) {
+        layout.cells = line->length;
+        layout.rows = line->displayRows;
+        layout.lastRowCells = line->lastRowCells;
+        layout.moved = line->moved;
+    }
+    findLayoutRows(&layout);
+    return layout;
+}
+
+/**
+ * Lays out `count` cells that are not the right half of a wide character.
+*/
+static void layoutCells(struct LineLayout *layout, long long count) {
+    if (count <= 0) return;
+    const long long filled = layout->lastRowCells + count - 1;
+    layout->rows += filled / layout->columns;
+    layout->lastRowCells = filled % layout->columns + 1;
+    layout->cells += count;
+    findLayoutRows(layout);
+}
+
+/**
+ * Lays out the right half of a wide character, moving the left half to the next row if it took the last column.
+*/
+static void layoutSpacer(struct LineLayout *layout) {
+    if (layout->lastRowCells < layout->columns || layout->columns < 2) {
+        layoutCells(layout, 1);
+        return;
+    }
+    layout->rows++;
+    layout->lastRowCells = 2;
+    layout->moved = 1;
+    layout->cells++;
+    findLayoutRows(layout);
+}
+
+static void layoutRow(struct LineLayout *layout, const unsigned int *cells, int length) {
+    int narrow = 0;
+    for (int x = 0; x < length; x++) {
+        if (!(cells[x] & CELL_SPACER)) {
+            narrow++;
+            continue;
+        }
+        layoutCells(layout, narrow);
+        narrow = 0;
+        layoutSpacer(layout);
+    }
+    layoutCells(layout, narrow);
+}
+
+/**
+ * Lays out the cells of a row written by encodeHistoryRow(), reading only where its wide characters are.
+*/
+static void layoutEncodedRow(struct LineLayout *layout, const unsigned char *input) {
+    const int length = readVarint(&input) >> 1;
+    for (int x = 0; x < length;) {
+        x += readVarint(&input);
+        const unsigned int value = readVarint(&input);
+        if (((value >> STYLE_FOREGROUND_SHIFT) & STYLE_COLOR_MASK) >= PALETTE_TRUECOLOR_BASE) readVarint(&input);
+        if (((value >> STYLE_BACKGROUND_SHIFT) & STYLE_COLOR_MASK) >= PALETTE_TRUECOLOR_BASE) readVarint(&input);
+        if (getStyleLink(value) != HYPERLINK_NONE) {
+            const int keyLength = readVarint(&input);
+            input += keyLength;
+        }
+    }
+
+    int narrow = 0;
+    for (int x = 0; x < length; x++) {
+        const unsigned int value = readVarint(&input);
+        if (value != HISTORY_SPACER) {
+            for (unsigned int i = HISTORY_CLUSTER; i < value; i++) readVarint(&input);
+            narrow++;
+            continue;
+        }
+        layoutCells(layout, narrow);
+        narrow = 0;
+        layoutSpacer(layout);
+    }
+    layoutCells(layout, narrow);
+}
+
+static void storeLayout(struct HistoryLine *line, const struct LineLayout *layout) {
+    line->length = layout->cells;
+    line->displayRows = layout->rows;
+    line->lastRowCells = layout->lastRowCells;
+    line->moved = layout->moved;
+}
+
+static void resetView(int columns) {
+    view.columns = columns;
+    view.first = view.capacity / 2;
+    view.count = 0;
+    view.indexedFrom = getHistoryEnd();
+    view.origin += 1LL << 32;
+}
+
+/**
+ * Makes room for a line at the front or the back of the index.
+*/
+static void reserveLine(int front) {
+    if (front ? view.first > 0 : view.first + view.count < view.capacity) return;
+    const int capacity = view.count * 2 > 256 ? view.count * 2 : 256;
+    struct HistoryLine *lines = malloc(capacity * sizeof(struct HistoryLine));
+    const int first = (capacity - view.count) / 2;
+    if (view.count > 0) memcpy(lines + first, view.lines + view.first, view.count * sizeof(struct HistoryLine));
+    free(view.lines);
+    view.lines = lines;
+    view.first = first;
+    view.capacity = capacity;
+}
+
+static int openSpillFile() {
+    const char *directory = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/terminal-history-XXXXXX", directory ? directory : "/tmp");
+    // Not inherited by the processes started to open links.
+    const int fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0) {
+        printf("Failed to create history spill file %s, keeping the history in memory.\n", path);
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+/**
+ * Moves a block's compressed data to the end of the spill file. The block stays in memory if it cannot be written.
+ * The block may already be spilled, since blocks taken back by truncateHistory() move the boundary of the resident
+ * blocks back.
+*/
+static void spillBlock(struct HistoryBlock *block) {
+    if (!block->data) {
+        return;
+    }
+    if (history.spillFd < 0) {
+        if (history.spillFailed) return;
+        history.spillFd = openSpillFile();
+        if (history.spillFd < 0) {
+            history.spillFailed = 1;
+            return;
+        }
+    }
+
+    if (pwrite(history.spillFd, block->data, block->size, history.spillSize) != block->size) {
+        printf("Failed to write history spill file.\n");
+        return;
+    }
+    free(block->data);
+    block->data = 0;
+    block->fileOffset = history.spillSize;
+    history.spillSize += block->size;
+}
+
+/**
+ * Decompresses a block, mapping its part of the spill file if it was spilled. Returns 0 if it cannot be read.
+*/
+static int loadBlock(const struct HistoryBlock *block, unsigned char *output) {
+    if (block->data) {
+        decompressBlock(block->data, block->size, output);
+        return 1;
+    }
+
+    const long long pageSize = sysconf(_SC_PAGESIZE);
+    const long long mapOffset = block->fileOffset / pageSize * pageSize;
+    const size_t mapSize = block->fileOffset - mapOffset + block->size;
+    unsigned char *mapping = mmap(0, mapSize, PROT_READ, MAP_PRIVATE, history.spillFd, mapOffset);
+    if (mapping == MAP_FAILED) {
+        printf("Failed to map history spill file.\n");
+        return 0;
+    }
+    decompressBlock(mapping + (block->fileOffset - mapOffset), block->size, output);
+    munmap(mapping, mapSize);
+    return 1;
+}
+
+/**
+ * Releases the memory or the part of the spill file holding a block.
+*/
+static void releaseBlock(struct HistoryBlock *block) {
+    history.compressedSize -= block->size;
+    if (block->data) {
+        free(block->data);
+        return;
+    }
+#ifdef FALLOC_FL_PUNCH_HOLE
+    fallocate(history.spillFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, block->fileOffset, block->size);
+#endif
+}
+
+static void dropOldestBlock() {
+    releaseBlock(&history.blocks[0]);
+    history.blockCount--;
+    memmove(history.blocks, history.blocks + 1, history.blockCount * sizeof(struct HistoryBlock));
+    history.start += HISTORY_BLOCK_ROWS;
+
+    while (view.count > 0 && view.lines[view.first].firstRow < history.start) {
+        view.first++;
+        view.count--;
+    }
+    view.indexedFrom = view.count > 0 ? view.lines[view.first].firstRow : getHistoryEnd();
+}
+
+/**
+ * Adds a compressed block after the newest one, spilling older blocks and dropping the oldest blocks once the history
+ * is over its size limit. Takes ownership of `data`.
+*/
+static void pushBlock(unsigned char *data, int size, int rawSize) {
+    if (history.blockCount == history.blockCapacity) {
+        history.blockCapacity = history.blockCapacity > 0 ? history.blockCapacity * 2 : 64;
+        history.blocks = realloc(history.blocks, history.blockCapacity * sizeof(struct HistoryBlock));
+    }
+
+    history.blocks[history.blockCount++] = (struct HistoryBlock) {
+        .data = data,
+        .serial = history.nextSerial++,
+        .size = size,
+        .rawSize = rawSize
+    };
+    history.compressedSize += size;
+
+    if (history.blockCount > HISTORY_RESIDENT_BLOCKS) {
+        spillBlock(&history.blocks[history.blockCount - HISTORY_RESIDENT_BLOCKS - 1]);
+    }
+
+    while (history.compressedSize > HISTORY_MAX_SIZE && history.blockCount > 1) {
+        dropOldestBlock();
+    }
+}
+
+static void closeBlock() {
+    unsigned char *data = malloc(COMPRESSED_SIZE_BOUND(history.openSize));
+    const int size = compressBlock(history.open, history.openSize, data);
+    const int rawSize = history.openSize;
+    history.openSize = 0;
+    history.openRows = 0;
+    pushBlock(realloc(data, size), size, rawSize);
+}
+
+/**
+ * Extends the index with a row added to the history, if the index has been started.
+*/
+static void indexAppendedRow(const unsigned int *cells, int length, int wrapped) {
+    const int continues = view.lastWrapped;
+    view.lastWrapped = wrapped;
+    if (view.count == 0) {
+        view.indexedFrom = getHistoryEnd();
+        return;
+    }
+
+    struct HistoryLine *last = &view.lines[view.first + view.count - 1];
+    if (continues) {
+        struct LineLayout layout = startLayout(last, view.columns, -1);
+        layoutRow(&layout, cells, length);
+        storeLayout(last, &layout);
+        return;
+    }
+
+    const long long displayStart = last->displayStart + last->displayRows;
+    struct LineLayout layout = startLayout(0, view.columns, -1);
+    layoutRow(&layout, cells, length);
+    reserveLine(0);
+    struct HistoryLine *line = &view.lines[view.first + view.count++];
+    line->firstRow = getHistoryEnd() - 1;
+    line->displayStart = displayStart;
+    storeLayout(line, &layout);
+}
+
+/**
+ * Returns the most bytes encodeHistoryRow() may write for a row.
+*/
+int getEncodedRowBound(const unsigned int *cells, int length) {
+    int maxSize = length * ENCODED_CELL_SIZE + 16;
+    for (int x = 0; x < length; x++) {
+        const int glyph = (cells[x] >> CELL_GLYPH_SHIFT) & CELL_GLYPH_MASK;
+        if (glyph >= GLYPH_FIXED_IDS && (getGlyphKey(glyph) & GLYPH_CLUSTER)) {
+            maxSize += (CLUSTER_MAX_LENGTH + 1) * 5;
+        }
+        if (x > 0 && cells[x] >> CELL_STYLE_SHIFT == cells[x - 1] >> CELL_STYLE_SHIFT) continue;
+        // Each run may store two 24-bit colors.
+        maxSize += 10;
+        const int link = getStyleLink(getStyle(cells[x] >> CELL_STYLE_SHIFT));
+        if (link != HYPERLINK_NONE) {
+            const char *key;
+            maxSize += getHyperlinkKey(link, &key) + 5;
+        }
+    }
+    return maxSize;
+}
+
+/**
+ * Adds a row to the end of the history. A row that wrapped onto the next one is stored whole so that the line can be
+ * reflowed, otherwise blank cells at the end of the row are not stored.
+*/
+void appendHistoryRow(const unsigned int *cells, int length, int wrapped) {
+    while (!wrapped && length > 0 && cells[length - 1] == 0) length--;
+
+    const int maxSize = getEncodedRowBound(cells, length);
+    if (maxSize > scratchCapacity) {
+        scratchCapacity = maxSize;
+        scratch = realloc(scratch, scratchCapacity);
+    }
+    const int size = encodeHistoryRow(cells, length, wrapped, scratch);
+
+    // Each row is prefixed with its encoded size, so rows in a block can be skipped without decoding them.
+    if (history.openSize + size + 5 > history.openCapacity) {
+        history.openCapacity = (history.openSize + size + 5) * 2;
+        history.open = realloc(history.open, history.openCapacity);
+    }
+    history.openOffsets[history.openRows] = history.openSize;
+    history.openSize += writeVarint(history.open + history.openSize, size);
+    memcpy(history.open + history.openSize, scratch, size);
+    history.openSize += size;
+    history.openRows++;
+
+    indexAppendedRow(cells, length, wrapped);
+    if (history.openRows == HISTORY_BLOCK_ROWS) {
+        closeBlock();
+    }
+}
+
+/**
+ * Returns the encoded row with the given id, decompressing its block if needed.
+*/
+static const unsigned char *findRow(long long id) {
+    const int block = (id - history.start) / HISTORY_BLOCK_ROWS;
+    const int index = (id - history.start) % HISTORY_BLOCK_ROWS;
+    const unsigned char *data;
+    if (block == history.blockCount) {
+        data = history.open + history.openOffsets[index];
+        readVarint(&data);
+        return data;
+    }
+
+    const long long blockStart = history.start + (long long) block * HISTORY_BLOCK_ROWS;
+    if (history.cacheStart != blockStart) {
+        const struct HistoryBlock *historyBlock = &history.blocks[block];
+        if (historyBlock->rawSize > history.cacheCapacity) {
+            history.cacheCapacity = historyBlock->rawSize;
+            history.cache = realloc(history.cache, history.cacheCapacity);
+        }
+        // A block that cannot be read back decodes as blank rows.
+        if (!loadBlock(historyBlock, history.cache)) {
+            memset(history.cache, 0, historyBlock->rawSize);
+        }
+        history.cacheStart = blockStart;
+
+        data = history.cache;
+        for (int row = 0; row < HISTORY_BLOCK_ROWS; row++) {
+            history.cacheOffsets[row] = data - history.cache;
+            const int size = readVarint(&data);
+            data += size;
+        }
+    }
+    data = history.cache + history.cacheOffsets[index];
+    readVarint(&data);
+    return data;
+}
+
+/**
+ * Returns the number of cells of a row written by encodeHistoryRow() and whether it wrapped.
+*/
+int getEncodedRowLength(const unsigned char *input, int *wrapped) {
+    const unsigned int header = readVarint(&input);
+    *wrapped = header & 1;
+    return header >> 1;
+}
+
+static int getRowLength(long long id, int *wrapped) {
+    return getEncodedRowLength(findRow(id), wrapped);
+}
+
+/**
+ * Removes the rows from `id` on, which must start a line. Blocks holding removed rows are decompressed back into the
+ * open block.
+*/
+static void truncateHistory(long long id) {
+    while (id < getHistoryEnd() - history.openRows) {
+        struct HistoryBlock *block = &history.blocks[--history.blockCount];
+        if (block->rawSize > history.openCapacity) {
+            history.openCapacity = block->rawSize;
+            history.open = realloc(history.open, history.openCapacity);
+        }
+        if (!loadBlock(block, history.open)) {
+            memset(history.open, 0, block->rawSize);
+        }
+        releaseBlock(block);
+        if (history.cacheStart == getHistoryEnd() - history.openRows) {
+            history.cacheStart = -1;
+        }
+
+        const unsigned char *data = history.open;
+        for (int row = 0; row < HISTORY_BLOCK_ROWS; row++) {
+            history.openOffsets[row] = data - history.open;
+            const int size = readVarint(&data);
+            data += size;
+        }
+        history.openRows = HISTORY_BLOCK_ROWS;
+        history.openSize = block->rawSize;
+    }
+
+    history.openRows = id - (getHistoryEnd() - history.openRows);
+    history.openSize = history.openRows > 0 ? history.openOffsets[history.openRows] : 0;
+    view.lastWrapped = 0;
+    while (view.count > 0 && view.lines[view.first + view.count - 1].firstRow >= id) {
+        view.count--;
+    }
+    if (view.count == 0) {
+        view.indexedFrom = getHistoryEnd();
+    }
+}
+
+/**
+ * If the newest line of the history wrapped onto the screen, removes its rows from the history and decodes them into
+ * `*cells`, which is grown as needed, so that the line can be reflowed as a whole. Returns the number of cells taken.
+ * Lines longer than a block are left in place.
+*/
+int takeWrappedHistoryLine(unsigned int **cells, int *capacity) {
+    const long long end = getHistoryEnd();
+    if (!view.lastWrapped || end == history.start) {
+        return 0;
+    }
+
+    long long row = end - 1;
+    int wrapped;
+    int length = getRowLength(row, &wrapped);
+    while (row > history.start && end - row < HISTORY_BLOCK_ROWS) {
+        const int previousLength = getRowLength(row - 1, &wrapped);
+        if (!wrapped) break;
+        length += previousLength;
+        row--;
+    }
+    if (row > history.start) {
+        getRowLength(row - 1, &wrapped);
+        if (wrapped) return 0;
+    }
+
+    if (length > *capacity) {
+        *capacity = length;
+        *cells = realloc(*cells, *capacity * sizeof(unsigned int));
+    }
+    int taken = 0;
+    for (long long id = row; id < end; id++) {
+        const int rowLength = getRowLength(id, &wrapped);
+        decodeHistoryRow(findRow(id), 0, *cells + taken, rowLength);
+        taken += rowLength;
+    }
+    truncateHistory(row);
+    return taken;
+}
+
+/**
+ * Adds the line ending where the index begins to the front of the index. Returns 0 if the whole history is indexed.
+*/
+static int indexPreviousLine() {
+    if (view.indexedFrom <= history.start) return 0;
+
+    long long row = view.indexedFrom - 1;
+    int wrapped;
+    while (row > history.start) {
+        getRowLength(row - 1, &wrapped);
+        if (!wrapped) break;
+        row--;
+    }
+
+    struct LineLayout layout = startLayout(0, view.columns, -1);
+    for (long long id = row; id < view.indexedFrom; id++) {
+        layoutEncodedRow(&layout, findRow(id));
+    }
+    const long long next = view.count > 0 ? view.lines[view.first].displayStart : view.origin;
+    const long long displayStart = next - layout.rows;
+    reserveLine(1);
+    struct HistoryLine *line = &view.lines[--view.first];
+    line->firstRow = row;
+    line->displayStart = displayStart;
+    storeLayout(line, &layout);
+    view.count++;
+    view.indexedFrom = row;
+    return 1;
+}
+
+/**
+ * Returns the number of rows the history takes up at the given width. Rows the history has not been scrolled back to
+ * yet are counted as they were written, so the count only becomes exact once the index reaches the oldest row.
+*/
+long long getHistoryDisplayRows(int columns) {
+    if (columns != view.columns) resetView(columns);
+    long long rows = view.indexedFrom - history.start;
+    if (view.count > 0) {
+        const struct HistoryLine *last = &view.lines[view.first + view.count - 1];
+        rows += last->displayStart + last->displayRows - view.lines[view.first].displayStart;
+    }
+    return rows;
+}
+
+/**
+ * Returns the coordinate of the display row `index` rows back from the end of the history at the given width, or
+ * HISTORY_ROW_NONE if the history is not that long. The index is extended back as far as the row.
+*/
+long long findHistoryDisplayRow(long long index, int columns) {
+    if (columns != view.columns) resetView(columns);
+    while (view.count == 0 || view.lines[view.first + view.count - 1].displayStart + view.lines[view.first + view.count - 1].displayRows - index <= view.lines[view.first].displayStart) {
+        if (!indexPreviousLine()) return HISTORY_ROW_NONE;
+    }
+    const struct HistoryLine *last = &view.lines[view.first + view.count - 1];
+    return last->displayStart + last->displayRows - 1 - index;
+}
+
+/**
+ * Decodes the display row with the given coordinate into `columns` cells, decoding only the part of the line that
+ * lands on the row. Rows that are no longer in the history are blank.
+*/
+void readHistoryDisplayRow(long long coordinate, unsigned int *cells, int columns) {
+    memset(cells, 0, columns * sizeof(unsigned int));
+    if (coordinate == HISTORY_ROW_NONE || columns != view.columns || view.count == 0) return;
+
+    int low = view.first;
+    int high = view.first + view.count - 1;
+    if (coordinate < view.lines[low].displayStart || coordinate >= view.lines[high].displayStart + view.lines[high].displayRows) return;
+    while (low < high) {
+        const int middle = (low + high + 1) / 2;
+        if (view.lines[middle].displayStart <= coordinate) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    const struct HistoryLine *line = &view.lines[low];
+    const int displayRow = coordinate - line->displayStart;
+    const long long end = getHistoryEnd();
+    long long from = (long long) displayRow * columns;
+    long long to = from + columns;
+    if (line->moved) {
+        // Rows of a line where a wide character moved to the next row only start where laying out the line says.
+        struct LineLayout layout = startLayout(0, columns, displayRow);
+        for (long long row = line->firstRow; row < end && layout.found[1] < 0; row++) {
+            const unsigned char *input = findRow(row);
+            int wrapped;
+            getEncodedRowLength(input, &wrapped);
+            layoutEncodedRow(&layout, input);
+            if (!wrapped) break;
+        }
+        from = layout.found[0];
+        to = layout.found[1] < 0 ? layout.cells : layout.found[1];
+    }
+
+    long long rowStart = 0;
+    for (long long row = line->firstRow; row < end && rowStart < to; row++) {
+        int wrapped;
+        const int length = getRowLength(row, &wrapped);
+        if (rowStart + length > from) {
+            const int start = from > rowStart ? from - rowStart : 0;
+            const int destination = rowStart + start - from;
+            int count = length - start;
+            if (destination + count > to - from) count = to - from - destination;
+            decodeHistoryRow(findRow(row), start, cells + destination, count);
+        }
+        rowStart += length;
+        if (!wrapped) break;
+    }
+}
+
+/**
+ * Returns the id of the oldest row in the history.
+*/
+long long getHistoryStart() {
+    return history.start;
+}
+
+/**
+ * Returns the id the next row added to the history will get.
+*/
+long long getHistoryEnd() {
+    return history.start + (long long) history.blockCount * HISTORY_BLOCK_ROWS + history.openRows;
+}
+
+int getHistoryBlockCount() {
+    return history.blockCount;
+}
+
+long long getHistoryBlockSerial(int index) {
+    return history.blocks[index].serial;
+}
+
+/**
+ * Returns the compressed data of a block, reading it back from the spill file if it was spilled, in which case the
+ * data is only valid until the next call. Returns 0 if the block cannot be read.
+*/
+const unsigned char *readHistoryBlock(int index, int *size, int *rawSize) {
+    const struct HistoryBlock *block = &history.blocks[index];
+    *size = block->size;
+    *rawSize = block->rawSize;
+    if (block->data) {
+        return block->data;
+    }
+
+    if (block->size > scratchCapacity) {
+        scratchCapacity = block->size;
+        scratch = realloc(scratch, scratchCapacity);
+    }
+    if (pread(history.spillFd, scratch, block->size, block->fileOffset) != block->size) {
+        printf("Failed to read history spill file.\n");
+        return 0;
+    }
+    return scratch;
+}
+
+/**
+ * Returns the rows that have not been compressed into a block yet, each prefixed with its encoded size.
+*/
+const unsigned char *getOpenHistoryRows(int *size, int *rows) {
+    *size = history.openSize;
+    *rows = history.openRows;
+    return history.open;
+}
+
+/**
+ * Adds a copy of a block read by readHistoryBlock() after the newest block, such as when restoring a snapshot. The
+ * open block must be empty. Returns the serial of the new block.
+*/
+long long addHistoryBlock(const unsigned char *data, int size, int rawSize) {
+    unsigned char *copy = malloc(size);
+    memcpy(copy, data, size);
+    pushBlock(copy, size, rawSize);
+    return history.blocks[history.blockCount - 1].serial;
+}
+
+/**
+ * Replaces the open block with rows returned by getOpenHistoryRows(), after the blocks have been added with
+ * addHistoryBlock(), and picks up indexing the history from its new end.
+*/
+void setOpenHistoryRows(const unsigned char *data, int size, int rows) {
+    if (size > history.openCapacity) {
+        history.openCapacity = size;
+        history.open = realloc(history.open, history.openCapacity);
+    }
+    memcpy(history.open, data, size);
+    history.openSize = size;
+    history.openRows = rows;
+
+    const unsigned char *row = history.open;
+    for (int i = 0; i < rows; i++) {
+        history.openOffsets[i] = row - history.open;
+        const int rowSize = readVarint(&row);
+        row += rowSize;
+    }
+
+    int wrapped = 0;
+    if (getHistoryEnd() > history.start) {
+        getRowLength(getHistoryEnd() - 1, &wrapped);
+    }
+    view.lastWrapped = wrapped;
+    resetView(view.columns);
+}
+
+/**
+ * Discards every row. Ids keep counting from where they were.
+*/
+void clearHistory() {
+    const long long end = getHistoryEnd();
+    // Spilled blocks go with the spill file, which is emptied below.
+    for (int i = 0; i < history.blockCount; i++) {
+        free(history.blocks[i].data);
+    }
+    history.blockCount = 0;
+    history.compressedSize = 0;
+    history.cacheStart = -1;
+    history.start = end;
+    history.openSize = 0;
+    history.openRows = 0;
+    if (history.spillFd >= 0) {
+        ftruncate(history.spillFd, 0);
+        history.spillSize = 0;
+    }
+    view.lastWrapped = 0;
+    resetView(view.columns);
+}
+
+void freeHistory() {
+    clearHistory();
+    free(history.blocks);
+    free(history.open);
+    free(history.cache);
+    free(scratch);
+    free(view.lines);
+    if (history.spillFd >= 0) {
+        close(history.spillFd);
+    }
+    history = (struct History) { .cacheStart = -1, .spillFd = -1 };
+    view = (struct HistoryView) { 0 };
+    scratch = 0;
+    scratchCapacity = 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <limits.h>
+
+#define HISTORY_ROW_NONE LLONG_MIN
+
+int getEncodedRowBound(const unsigned int *cells, int length);
+int encodeHistoryRow(const unsigned int *cells, int length, int wrapped, unsigned char *output);
+int getEncodedRowLength(const unsigned char *input, int *wrapped);
+void decodeHistoryRow(const unsigned char *input, int from, unsigned int *cells, int count);
+void appendHistoryRow(const unsigned int *cells, int length, int wrapped);
+long long getHistoryDisplayRows(int columns);
+long long findHistoryDisplayRow(long long index, int columns);
+void readHistoryDisplayRow(long long coordinate, unsigned int *cells, int columns);
+int takeWrappedHistoryLine(unsigned int **cells, int *capacity);
+long long getHistoryStart();
+long long getHistoryEnd();
+int getHistoryBlockCount();
+long long getHistoryBlockSerial(int index);
+const unsigned char *readHistoryBlock(int index, int *size, int *rawSize);
+const unsigned char *getOpenHistoryRows(int *size, int *rows);
+long long addHistoryBlock(const unsigned char *data, int size, int rawSize);
+void setOpenHistoryRows(const unsigned char *data, int size, int rows);
+void clearHistory();
+void freeHistory();
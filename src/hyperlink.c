@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "terminal.h"
+#include "hyperlink.h"
+
+#define HYPERLINK_HASH_SIZE (HYPERLINK_TABLE_SIZE * 2)
+// Longest id parameter kept, longer ids are truncated.
+#define HYPERLINK_MAX_ID 64
+
+/**
+ * A stored link. The URI and id are one allocation, "<id>\0<uri>\0", so that links are compared with one memcmp.
+*/
+struct Hyperlink {
+    char *key;
+    int keyLength;
+    int references;
+};
+
+/**
+ * The OSC 8 command being received. The URI is collected as it arrives, since it is longer than the parser's
+ * argument buffer.
+*/
+struct HyperlinkTransfer {
+    char *key;
+    int keyLength;
+    int capacity;
+    int idLength;
+    int truncated;
+};
+
+static struct Hyperlink links[HYPERLINK_TABLE_SIZE];
+// Ids that were never used start at nextId, released ids are kept in freeIds.
+static int nextId = 1;
+static unsigned short freeIds[HYPERLINK_TABLE_SIZE];
+static int freeCount = 0;
+// Open addressing table of link ids, 0 marks an empty slot.
+static unsigned short linkTable[HYPERLINK_HASH_SIZE];
+static struct HyperlinkTransfer transfer;
+// Link applied to printed text, holding a reference while open.
+static int currentLink = HYPERLINK_NONE;
+
+static unsigned int hashKey(const char *key, int length) {
+    unsigned int hash = 0x811c9dc5;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) key[i]) * 0x01000193;
+    }
+    return hash % HYPERLINK_HASH_SIZE;
+}
+
+/**
+ * Returns the id of a link with a reference held for the caller, adding the link the first time it is seen. The
+ * key is the id parameter and the URI, each followed by a null byte. Once every id is taken, returns HYPERLINK_NONE
+ * and has unused styles collected, which frees the ids of links that are no longer shown.
+*/
+int internHyperlink(const char *key, int length) {
+    unsigned int slot = hashKey(key, length);
+    while (linkTable[slot] != 0) {
+        const int id = linkTable[slot];
+        if (links[id].keyLength == length && memcmp(links[id].key, key, length) == 0) {
+            links[id].references++;
+            return id;
+        }
+        slot = (slot + 1) % HYPERLINK_HASH_SIZE;
+    }
+
+    int id;
+    if (freeCount > 0) {
+        id = freeIds[--freeCount];
+    } else if (nextId < HYPERLINK_TABLE_SIZE) {
+        id = nextId++;
+    } else {
+        collectStylesSoon();
+        return HYPERLINK_NONE;
+    }
+
+    links[id] = (struct Hyperlink) {
+        .key = malloc(length),
+        .keyLength = length,
+        .references = 1
+    };
+    memcpy(links[id].key, key, length);
+    linkTable[slot] = id;
+    return id;
+}
+
+void holdHyperlink(int id) {
+    if (id != HYPERLINK_NONE) {
+        links[id].references++;
+    }
+}
+
+/**
+ * Drops a reference to a link, freeing it and its id with the last one.
+*/
+void releaseHyperlink(int id) {
+    if (id == HYPERLINK_NONE || --links[id].references > 0) {
+        return;
+    }
+
+    unsigned int hole = hashKey(links[id].key, links[id].keyLength);
+    while (linkTable[hole] != id) {
+        hole = (hole + 1) % HYPERLINK_HASH_SIZE;
+    }
+    // Later links of the probe sequence that could sit in the freed slot are moved back, so that lookups never
+    // stop early at it.
+    for (unsigned int slot = (hole + 1) % HYPERLINK_HASH_SIZE; linkTable[slot] != 0; slot = (slot + 1) % HYPERLINK_HASH_SIZE) {
+        const struct Hyperlink *moved = &links[linkTable[slot]];
+        const unsigned int home = hashKey(moved->key, moved->keyLength);
+        const int between = hole < slot ? home > hole && home <= slot : home > hole || home <= slot;
+        if (!between) {
+            linkTable[hole] = linkTable[slot];
+            hole = slot;
+        }
+    }
+    linkTable[hole] = 0;
+    free(links[id].key);
+    links[id] = (struct Hyperlink) { 0 };
+    freeIds[freeCount++] = id;
+}
+
+/**
+ * Points `key` at the key of a link, see internHyperlink(), and returns its length.
+*/
+int getHyperlinkKey(int id, const char **key) {
+    *key = links[id].key;
+    return links[id].keyLength;
+}
+
+const char *getHyperlinkUri(int id) {
+    return links[id].key + strlen(links[id].key) + 1;
+}
+
+int getCurrentHyperlink() {
+    return currentLink;
+}
+
+static void appendKey(const unsigned char *data, int length) {
+    if (transfer.keyLength + length > transfer.capacity) {
+        transfer.capacity = transfer.capacity > 0 ? transfer.capacity * 2 : 256;
+        transfer.key = realloc(transfer.key, transfer.capacity);
+    }
+    memcpy(transfer.key + transfer.keyLength, data, length);
+    transfer.keyLength += length;
+}
+
+/**
+ * Starts an OSC 8 command (8;<params>;<uri>) once its parameters are known. The parameters are a list of
+ * key=value pairs separated by colons, of which only id is used.
+*/
+void hyperlinkBegin(const unsigned char *params, int length) {
+    transfer.keyLength = 0;
+    transfer.truncated = 0;
+    for (int i = 0; i < length; ) {
+        int end = i;
+        while (end < length && params[end] != ':') end++;
+        if (end - i > 3 && memcmp(params + i, "id=", 3) == 0) {
+            const int idLength = end - i - 3 < HYPERLINK_MAX_ID ? end - i - 3 : HYPERLINK_MAX_ID;
+            appendKey(params + i + 3, idLength);
+        }
+        i = end + 1;
+    }
+    appendKey((const unsigned char *) "", 1);
+    transfer.idLength = transfer.keyLength;
+}
+
+void hyperlinkAppend(unsigned char byte) {
+    if (transfer.keyLength - transfer.idLength >= HYPERLINK_MAX_URI) {
+        transfer.truncated = 1;
+        return;
+    }
+    appendKey(&byte, 1);
+}
+
+/**
+ * Finishes an OSC 8 command. A URI opens a link for the text printed after it, and an empty URI closes the open
+ * link.
+*/
+void hyperlinkEnd() {
+    const int link = transfer.keyLength > transfer.idLength && !transfer.truncated;
+    appendKey((const unsigned char *) "", 1);
+    releaseHyperlink(currentLink);
+    currentLink = link ? internHyperlink(transfer.key, transfer.keyLength) : HYPERLINK_NONE;
+}
+
+/**
+ * Returns whether a URI has one of the schemes links may be opened with. Anything printed to the terminal can make
+ * a link, so schemes whose handlers run commands or install things are refused.
+*/
+static int isOpenableUri(const char *uri) {
+    static const char *schemes[] = { "http:", "https:", "file:" };
+    for (int i = 0; i < (int) (sizeof(schemes) / sizeof(schemes[0])); i++) {
+        if (strncasecmp(uri, schemes[i], strlen(schemes[i])) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Opens the URI of a link with the desktop's default handler. The handler runs in a grandchild process in its own
+ * session, so that it never has to be waited for and is not tied to the terminal.
+*/
+void openHyperlink(int id) {
+    if (id == HYPERLINK_NONE || links[id].references == 0) {
+        return;
+    }
+    const char *uri = getHyperlinkUri(id);
+    if (!isOpenableUri(uri)) {
+        printf("Not opening hyperlink %s, only http, https and file links are opened.\n", uri);
+        return;
+    }
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        if (fork() == 0) {
+            setsid();
+            // xdg-open takes no options and rejects "--", and a URI starting with one of the schemes above cannot
+            // be read as an option.
+            execlp("xdg-open", "xdg-open", uri, (char *) 0);
+            _exit(127);
+        }
+        _exit(0);
+    } else if (pid > 0) {
+        waitpid(pid, 0, 0);
+    } else {
+        printf("Failed to open hyperlink %s.\n", uri);
+    }
+}
+
+void freeHyperlinks() {
+    for (int id = 1; id < nextId; id++) {
+        free(links[id].key);
+        links[id] = (struct Hyperlink) { 0 };
+    }
+    memset(linkTable, 0, sizeof(linkTable));
+    nextId = 1;
+    freeCount = 0;
+    currentLink = HYPERLINK_NONE;
+    free(transfer.key);
+    transfer = (struct HyperlinkTransfer) { 0 };
+}
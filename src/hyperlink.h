@@ -0,0 +1,24 @@
+#pragma once
+
+/**
+ * Hyperlinks set with OSC 8. Each distinct link, its URI and optional id parameter, is stored once and referred to
+ * by a small id that is part of the style of the linked cells, see cell.h. Links are reference counted by the
+ * styles that hold their id and by the parser while a link is open. Rows in the history store the link itself,
+ * so only links shown in the grid take an id.
+*/
+#define HYPERLINK_NONE 0
+#define HYPERLINK_TABLE_SIZE (STYLE_LINK_MASK + 1)
+// Longest URI accepted. Links with longer URIs are ignored and their text is printed without a link.
+#define HYPERLINK_MAX_URI 8192
+
+void hyperlinkBegin(const unsigned char *params, int length);
+void hyperlinkAppend(unsigned char byte);
+void hyperlinkEnd();
+int internHyperlink(const char *key, int length);
+int getHyperlinkKey(int id, const char **key);
+int getCurrentHyperlink();
+const char *getHyperlinkUri(int id);
+void holdHyperlink(int id);
+void releaseHyperlink(int id);
+void openHyperlink(int id);
+void freeHyperlinks();
@@ -0,0 +1,1158 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+#include "cluster.h"
+#include "glyph.h"
+#include "grid.h"
+#include "history.h"
+#include "screen.h"
+#include "width.h"
+
+extern struct RenderContext renderContext;
+
+// First grid row used to show history rows, the display row coordinate loaded into each of them, and the end of
+// the history when they were loaded, since the newest line may have grown since.
+static int historyViewRow;
+static long long *historyViewIds;
+static long long historyViewEnd;
+// Cells of a row, for rows that are read without being written.
+static unsigned int *rowBuffer;
+static int rowBufferSize;
+// Number of the oldest rows of the primary screen's ring that were moved to the history ahead of time by
+// beginSkippedRows(). The ring does not archive them again when it reuses their positions.
+static int skippedRingRows;
+
+/**
+ * Row written outside the grid while lines are skipped, with the same erase semantics as a grid row: cells from
+ * `written` on are `blank`.
+*/
+struct SkippedRow {
+    unsigned int *cells;
+    int capacity;
+    int written;
+    unsigned int blank;
+    int wrapped;
+    // Column of the cursor, which is `columns` while a wrap is pending.
+    int x;
+    // Rows completed since beginSkippedRows(), each of which scrolled the screen once.
+    int completed;
+};
+
+static struct SkippedRow skippedRow;
+
+static int ringPosition(const struct Screen *screen, int y) {
+    return (y + screen->rowOffset) % screen->rowCount;
+}
+
+/**
+ * Gives `screen` the `rowCount` rows of the cell grid starting at `firstRow`.
+*/
+static void initScreenRows(struct Screen *screen, int *rowMap, int rowCount, int firstRow) {
+    screen->rowMap = rowMap;
+    screen->rowCount = rowCount;
+    for (int i = 0; i < rowCount; i++) {
+        rowMap[i] = firstRow + i;
+    }
+}
+
+/**
+ * Sets up the screens without any rows. The grid is allocated by the first call to resizeScreen().
+*/
+void initScreen() {
+    renderContext.screen = &renderContext.primaryScreen;
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+    renderContext.lastCharacter = -1;
+}
+
+void freeScreen() {
+    freeHistory();
+    free(historyViewIds);
+    free(rowBuffer);
+    free(skippedRow.cells);
+    historyViewIds = 0;
+    rowBuffer = 0;
+    rowBufferSize = 0;
+    skippedRow = (struct SkippedRow) { 0 };
+    freeGrid(renderContext.grid);
+    renderContext.grid = 0;
+    free(renderContext.primaryScreen.rowMap);
+    free(renderContext.alternateScreen.rowMap);
+    renderContext.primaryScreen.rowMap = 0;
+    renderContext.alternateScreen.rowMap = 0;
+}
+
+/**
+ * Returns the row of the cell grid holding the cells of `screen` at screen row `y`, where negative rows are the
+ * scrollback of the ring. Rows inside the scroll region are offset by the region's rotation.
+*/
+static int getScreenRow(const struct Screen *screen, int y) {
+    if (y < 0) {
+        return screen->rowMap[(y + screen->rowOffset + screen->rowCount) % screen->rowCount];
+    }
+    if (screen->scrollRegionShift != 0 && y >= screen->scrollRegionTop && y <= screen->scrollRegionBottom) {
+        const int height = screen->scrollRegionBottom - screen->scrollRegionTop + 1;
+        y = screen->scrollRegionTop + (y - screen->scrollRegionTop + screen->scrollRegionShift) % height;
+    }
+    return screen->rowMap[ringPosition(screen, y)];
+}
+
+/**
+ * Returns the row of the cell grid holding the cells shown at screen row `y`.
+*/
+int getStorageRow(int y) {
+    return getScreenRow(renderContext.screen, y);
+}
+
+/**
+ * Returns the number of rows above the screen that can be scrolled into view, from both the ring and the history.
+ * The alternate screen has no scrollback. Until the history has been scrolled all the way back, its part is an
+ * estimate, see getHistoryDisplayRows().
+*/
+int getScrollbackRows() {
+    if (renderContext.screen == &renderContext.alternateScreen) {
+        return 0;
+    }
+    const long long rows = renderContext.primaryScreen.scrollbackCount + getHistoryDisplayRows(renderContext.grid->columns);
+    return rows < INT_MAX ? (int) rows : INT_MAX;
+}
+
+static void invalidateHistoryView() {
+    for (int y = 0; y < renderContext.screenTileSize.y; y++) {
+        historyViewIds[y] = HISTORY_ROW_NONE;
+    }
+    historyViewEnd = getHistoryEnd();
+}
+
+/**
+ * Discards the scrollback of the primary screen, both in the ring and in the history.
+*/
+void clearScrollback() {
+    renderContext.primaryScreen.scrollbackCount = 0;
+    skippedRingRows = 0;
+    clearHistory();
+    invalidateHistoryView();
+    renderContext.scrollOffset = 0;
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+}
+
+/**
+ * Copies a display row of the history into the grid row that shows screen row `y` while scrolled back, and
+ * returns that grid row. A row is only decoded when it was not already loaded there.
+*/
+static int loadHistoryRow(int y, long long coordinate) {
+    struct CellGrid *grid = renderContext.grid;
+    const int row = historyViewRow + y;
+    if (historyViewIds[y] != coordinate) {
+        readHistoryDisplayRow(coordinate, getWritableRow(row, grid->columns), grid->columns);
+        markCellsDirty(row, 0, grid->columns);
+        historyViewIds[y] = coordinate;
+    }
+    return row;
+}
+
+/**
+ * Returns the grid row displayed at screen row `y`, loading it from the history when scrolled back that far.
+*/
+static int getDisplayedRow(int y) {
+    const struct Screen *screen = renderContext.screen;
+    const int screenY = y - renderContext.scrollOffset;
+    if (-screenY <= screen->scrollbackCount) {
+        return getScreenRow(screen, screenY);
+    }
+    const long long index = -screenY - screen->scrollbackCount - 1;
+    return loadHistoryRow(y, findHistoryDisplayRow(index, renderContext.grid->columns));
+}
+
+/**
+ * Writes the row map entry of the grid row shown at each screen row to `rows`, taking the scroll offset into
+ * account, see getShaderRow().
+*/
+void getDisplayedRows(struct ShaderRow *rows) {
+    struct Screen *screen = renderContext.screen;
+    const int columns = renderContext.grid->columns;
+    if (getHistoryEnd() != historyViewEnd) {
+        invalidateHistoryView();
+    }
+    // Indexing the history back to the top row makes its size exact up to there, so the offset can be clamped.
+    if (renderContext.scrollOffset > screen->scrollbackCount) {
+        findHistoryDisplayRow(renderContext.scrollOffset - screen->scrollbackCount - 1, columns);
+        const int scrollbackRows = getScrollbackRows();
+        if (renderContext.scrollOffset > scrollbackRows) renderContext.scrollOffset = scrollbackRows;
+    }
+
+    for (int y = 0; y < renderContext.screenTileSize.y; y++) {
+        rows[y] = getShaderRow(getDisplayedRow(y));
+    }
+}
+
+/**
+ * Writes the displayed rows to the current shader context slot. Only runs when the row map has changed since the
+ * slot was last written.
+*/
+void updateShaderRowMap() {
+    const int slotBit = 1 << renderContext.shaderContextSlot;
+    if (!(renderContext.rowMapDirty & slotBit)) {
+        return;
+    }
+
+    getDisplayedRows(renderContext.shaderRowMap);
+    renderContext.rowMapDirty &= ~slotBit;
+}
+
+/**
+ * Returns the cell displayed at a screen position, taking the scroll offset into account.
+*/
+unsigned int getDisplayedCell(int x, int y) {
+    const struct CellGrid *grid = renderContext.grid;
+    if (getHistoryEnd() != historyViewEnd) {
+        invalidateHistoryView();
+    }
+    const int row = getDisplayedRow(y);
+    return x >= grid->blankFrom[row] ? grid->blankCell[row] : grid->cells[row * grid->columns + x];
+}
+
+/**
+ * Blanks the other half of any double-width character that writing columns [xStart, xEnd) of the storage row would
+ * cut in two, keeping its style. Cells erased through blankFrom are blank and are never half of a character.
+*/
+static void splitWideCharacters(int row, int xStart, int xEnd) {
+    struct CellGrid *grid = renderContext.grid;
+    unsigned int *cells = &grid->cells[row * grid->columns];
+    const int written = grid->blankFrom[row];
+    if (xStart > 0 && xStart < written && (cells[xStart] & CELL_SPACER)) {
+        cells[xStart - 1] &= ~CELL_CONTENT_MASK;
+        markCellsDirty(row, xStart - 1, xStart);
+    }
+    if (xEnd < written && (cells[xEnd] & CELL_SPACER)) {
+        cells[xEnd] &= ~CELL_CONTENT_MASK;
+        markCellsDirty(row, xEnd, xEnd + 1);
+    }
+}
+
+/**
+ * Blanks `count` cells of the storage row starting at column `x`. Erased cells take the current background color,
+ * matching xterm. Erasing up to the end of the row, as erase in line and erase in display do, only moves the row's
+ * blankFrom column, see clearCells().
+*/
+static void eraseCells(int row, int x, int count) {
+    struct CellGrid *grid = renderContext.grid;
+    const unsigned int blank = packCell(0, getBlankStyle());
+    splitWideCharacters(row, x, x + count);
+    if (x + count >= grid->columns) {
+        clearCells(row, x, blank);
+        return;
+    }
+    if (grid->blankFrom[row] <= x && grid->blankCell[row] == blank) {
+        return;
+    }
+
+    unsigned int *cells = getWritableRow(row, x + count) + x;
+    markCellsDirty(row, x, x + count);
+    if (blank == 0) {
+        memset(cells, 0, count * sizeof(unsigned int));
+    } else {
+        for (int i = 0; i < count; i++) {
+            cells[i] = blank;
+        }
+    }
+}
+
+static void clearRows(int yStart, int yEnd) {
+    for (int y = yStart; y <= yEnd; y++) {
+        eraseCells(getStorageRow(y), 0, renderContext.grid->columns);
+    }
+}
+
+static void reverseRows(struct Screen *screen, int yStart, int yEnd) {
+    while (yStart < yEnd) {
+        const int start = ringPosition(screen, yStart++);
+        const int end = ringPosition(screen, yEnd--);
+        const int row = screen->rowMap[start];
+        screen->rowMap[start] = screen->rowMap[end];
+        screen->rowMap[end] = row;
+    }
+}
+
+/**
+ * Rotates the storage rows of screen rows [yStart, yEnd] down by `count`, so the last `count` rows wrap around
+ * to the top. Only the row map changes, no cells are copied.
+*/
+static void rotateRowsDown(struct Screen *screen, int yStart, int yEnd, int count) {
+    reverseRows(screen, yStart, yEnd);
+    reverseRows(screen, yStart, yStart + count - 1);
+    reverseRows(screen, yStart + count, yEnd);
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+}
+
+/**
+ * Applies the scroll region's rotation to the row map itself, so that screen rows map directly to ring positions
+ * again. Needed before operations that permute the row map or move the ring.
+*/
+static void normalizeScrollRegion(struct Screen *screen) {
+    if (screen->scrollRegionShift == 0) {
+        return;
+    }
+
+    const int height = screen->scrollRegionBottom - screen->scrollRegionTop + 1;
+    const int shift = screen->scrollRegionShift;
+    screen->scrollRegionShift = 0;
+    rotateRowsDown(screen, screen->scrollRegionTop, screen->scrollRegionBottom, height - shift);
+}
+
+/**
+ * Copies the overlapping columns of a row of `from` into a row of the current grid. Erased cells stay erased.
+*/
+static void copyRow(struct CellGrid *from, int fromRow, int toRow) {
+    const int columns = renderContext.grid->columns;
+    const int written = from->blankFrom[fromRow] < columns ? from->blankFrom[fromRow] : columns;
+    memcpy(getWritableRow(toRow, written), &from->cells[fromRow * from->columns], written * sizeof(unsigned int));
+    if (written < columns) {
+        clearCells(toRow, written, from->blankCell[fromRow]);
+    }
+    renderContext.grid->wrapped[toRow] = from->wrapped[fromRow];
+}
+
+/**
+ * Returns the cells of a row of `grid` for reading. The cells of a row with erased cells are copied into a buffer
+ * with the erased cells filled in, instead of filling them in the grid.
+*/
+static const unsigned int *readRow(struct CellGrid *grid, int row) {
+    const unsigned int *cells = &grid->cells[row * grid->columns];
+    const int blankFrom = grid->blankFrom[row];
+    if (blankFrom == grid->columns) {
+        return cells;
+    }
+
+    if (grid->columns > rowBufferSize) {
+        rowBufferSize = grid->columns;
+        rowBuffer = realloc(rowBuffer, rowBufferSize * sizeof(unsigned int));
+    }
+    memcpy(rowBuffer, cells, blankFrom * sizeof(unsigned int));
+    for (int x = blankFrom; x < grid->columns; x++) {
+        rowBuffer[x] = grid->blankCell[row];
+    }
+    return rowBuffer;
+}
+
+/**
+ * Returns the number of cells of a row that belong to its line: all of them if the line continues on the next row,
+ * otherwise up to the last cell that is not blank. A blank last cell left by a wide character that moved on to
+ * `nextRow`, or -1 if there is none, is not part of the line.
+*/
+static int getLineCells(struct CellGrid *grid, int row, int nextRow) {
+    const int blankFrom = grid->blankFrom[row];
+    const unsigned int *cells = &grid->cells[row * grid->columns];
+    if (grid->wrapped[row]) {
+        const unsigned int last = blankFrom < grid->columns ? grid->blankCell[row] : cells[grid->columns - 1];
+        const int moved = nextRow >= 0 && grid->blankFrom[nextRow] > 0
+                && (grid->cells[nextRow * grid->columns] & CELL_WIDE);
+        return last == 0 && moved ? grid->columns - 1 : grid->columns;
+    }
+    if (blankFrom < grid->columns && grid->blankCell[row] != 0) {
+        return grid->columns;
+    }
+
+    int length = blankFrom;
+    while (length > 0 && cells[length - 1] == 0) length--;
+    return length;
+}
+
+/**
+ * Moves a row of `grid`, followed by `nextRow`, to the end of the history. Rows erased to the default blank are
+ * stored as empty without filling in their cells.
+*/
+static void archiveRow(struct CellGrid *grid, int row, int nextRow) {
+    if (grid->blankFrom[row] == 0 && grid->blankCell[row] == 0) {
+        appendHistoryRow(0, 0, 0);
+    } else {
+        appendHistoryRow(readRow(grid, row), getLineCells(grid, row, nextRow), grid->wrapped[row]);
+    }
+}
+
+/**
+ * Gives `screen` a ring of `rowCount` rows in the current grid starting at `firstRow`. Returns the old ring with
+ * its scroll region applied, so that its screen rows map directly to ring positions.
+*/
+static struct Screen replaceScreenRows(struct Screen *screen, struct CellGrid *oldGrid, int rowCount, int firstRow) {
+    struct Screen old = *screen;
+    if (oldGrid) {
+        normalizeScrollRegion(&old);
+    }
+
+    initScreenRows(screen, malloc(rowCount * sizeof(int)), rowCount, firstRow);
+    screen->rowOffset = 0;
+    screen->scrollRegionShift = 0;
+    screen->scrollbackCount = 0;
+    if (screen == &renderContext.primaryScreen) {
+        skippedRingRows = 0;
+    }
+    return old;
+}
+
+/**
+ * Appends the cells of the line starting at `rows[*y]` to `line` after its first `length` cells, and returns the
+ * line's length. `*y` is moved past the line's rows.
+*/
+static int joinLine(struct CellGrid *grid, const int *rows, int rowCount, int *y, unsigned int *line, int length) {
+    int lineEnd = 0;
+    do {
+        const int row = rows[*y];
+        lineEnd = *y == rowCount - 1 || !grid->wrapped[row];
+        const int cells = getLineCells(grid, row, lineEnd ? -1 : rows[*y + 1]);
+        memcpy(line + length, readRow(grid, row), cells * sizeof(unsigned int));
+        length += cells;
+        (*y)++;
+    } while (!lineEnd);
+    return length;
+}
+
+/**
+ * Returns the number of cells of `line` from `start` on that go on one row of `columns` cells. As when printing, a
+ * wide character that does not fit in the last column moves to the next row.
+*/
+static int getSegmentCells(const unsigned int *line, int start, int length, int columns) {
+    if (length - start <= columns) {
+        return length > start ? length - start : 0;
+    }
+    return columns > 1 && (line[start + columns] & CELL_SPACER) ? columns - 1 : columns;
+}
+
+/**
+ * Moves the primary screen into the current grid, reflowing its lines to the new width. The scrollback in the ring
+ * moves to the history, which reflows lazily as it is scrolled back. The visible rows are joined into lines and split
+ * again at the new width, keeping the cursor on screen at the same place in its line; rows pushed off the top go to
+ * the history.
+*/
+static void reflowPrimaryScreen(struct CellGrid *oldGrid, int rowCount, int visibleRows, int oldVisibleRows) {
+    struct Screen *screen = &renderContext.primaryScreen;
+    struct Screen old = replaceScreenRows(screen, oldGrid, rowCount, 0);
+    if (!oldGrid) {
+        free(old.rowMap);
+        return;
+    }
+
+    for (int distance = old.scrollbackCount; distance > 0; distance--) {
+        archiveRow(oldGrid, old.rowMap[(old.rowOffset - distance + old.rowCount) % old.rowCount],
+                   old.rowMap[(old.rowOffset - distance + 1 + old.rowCount) % old.rowCount]);
+    }
+
+    // A line that wrapped from the history onto the screen is taken back, so it is reflowed as a whole.
+    unsigned int *line = 0;
+    int lineCapacity = 0;
+    const int taken = takeWrappedHistoryLine(&line, &lineCapacity);
+    const int oldColumns = oldGrid->columns;
+    const int columns = renderContext.grid->columns;
+    if (taken + oldVisibleRows * oldColumns > lineCapacity) {
+        lineCapacity = taken + oldVisibleRows * oldColumns;
+        line = realloc(line, lineCapacity * sizeof(unsigned int));
+    }
+
+    int *oldRows = malloc(oldVisibleRows * sizeof(int));
+    for (int y = 0; y < oldVisibleRows; y++) {
+        oldRows[y] = old.rowMap[ringPosition(&old, y)];
+    }
+
+    // First pass counts the rows each line takes at the new width, to find the new cursor row. The cursor's line
+    // takes enough rows to reach the cursor, even past its last cell. The saved cursor is the one to follow while
+    // the alternate screen is in use.
+    struct Vec2i *cursor = renderContext.screen == screen ? &renderContext.cursorPosition : &screen->savedCursorPosition;
+    // With a wrap pending the cursor is past the cell under it, and the wrap stays pending only if that cell ends a
+    // row at the new width.
+    const int wrapPending = renderContext.screen == screen && renderContext.wrapPending;
+    int *lineRows = malloc(oldVisibleRows * sizeof(int));
+    int lineCount = 0;
+    int totalRows = 0;
+    int cursorRow = 0;
+    int cursorColumn = 0;
+    for (int y = 0; y < oldVisibleRows; lineCount++) {
+        const int lineStart = y;
+        // Lines after the first are put after the cells taken from the history, which the second pass still needs.
+        unsigned int *cells = lineCount == 0 ? line : line + taken;
+        const int length = joinLine(oldGrid, oldRows, oldVisibleRows, &y, cells, lineCount == 0 ? taken : 0);
+
+        int rows = 0;
+        int start = 0;
+        int segmentStart = 0;
+        do {
+            segmentStart = start;
+            start += getSegmentCells(cells, start, length, columns);
+            rows++;
+        } while (start < length);
+
+        if (cursor->y >= lineStart && cursor->y < y) {
+            // Cells dropped from the ends of wrapped rows by getLineCells() are not counted in the cursor's offset.
+            int offset = (lineCount == 0 ? taken : 0) + cursor->x;
+            for (int row = lineStart; row < cursor->y; row++) {
+                offset += getLineCells(oldGrid, oldRows[row], oldRows[row + 1]);
+            }
+            // The cursor is on the segment holding its cell, or past the end of the line at the full width.
+            int cursorSegment = rows - 1;
+            start = 0;
+            for (int segment = 0; segment < rows; segment++) {
+                const int count = getSegmentCells(cells, start, length, columns);
+                if (offset < start + count) {
+                    cursorSegment = segment;
+                    segmentStart = start;
+                    break;
+                }
+                start += count;
+            }
+            cursorSegment += (offset - segmentStart) / columns;
+            if (cursorSegment + 1 > rows) rows = cursorSegment + 1;
+            cursorRow = totalRows + cursorSegment;
+            cursorColumn = (offset - segmentStart) % columns;
+            if (wrapPending && cursorColumn < columns - 1) {
+                cursorColumn++;
+                renderContext.wrapPending = 0;
+            }
+        }
+        lineRows[lineCount] = rows;
+        totalRows += rows;
+    }
+
+    // Second pass writes the rows from `top` on that fit on the screen, after moving the rows above to the history.
+    const int top = cursorRow - (visibleRows - 1) > 0 ? cursorRow - (visibleRows - 1) : 0;
+    int newRow = 0;
+    for (int y = 0, i = 0; y < oldVisibleRows && newRow < top + visibleRows; i++) {
+        const int length = joinLine(oldGrid, oldRows, oldVisibleRows, &y, line, i == 0 ? taken : 0);
+        int start = 0;
+        for (int segment = 0; segment < lineRows[i] && newRow < top + visibleRows; segment++, newRow++) {
+            const int count = getSegmentCells(line, start, length, columns);
+            const int wrapped = segment < lineRows[i] - 1;
+            if (newRow < top) {
+                appendHistoryRow(line + start, count, wrapped);
+            } else {
+                memcpy(getWritableRow(newRow - top, count), line + start, count * sizeof(unsigned int));
+                renderContext.grid->wrapped[newRow - top] = wrapped;
+            }
+            start += count;
+        }
+    }
+    free(line);
+    free(lineRows);
+    free(oldRows);
+    free(old.rowMap);
+
+    cursor->x = cursorColumn;
+    cursor->y = cursorRow - top;
+}
+
+/**
+ * Moves both screens into a new grid of `columns` x `rows` cells plus the scrollback rows and the rows showing the
+ * history. The primary screen is reflowed to the new width, while the alternate screen, whose application redraws
+ * it anyway, is cut off or padded. Must be called before screenTileSize is changed to the new size.
+*/
+void resizeScreen(int columns, int rows) {
+    struct CellGrid *oldGrid = renderContext.grid;
+    const int oldRows = renderContext.screenTileSize.y;
+    const int primaryRows = renderContext.scrollbackRows + rows;
+    if (renderContext.screen == &renderContext.alternateScreen) {
+        renderContext.wrapPending = 0;
+    }
+
+    renderContext.grid = createGrid(columns, primaryRows + rows * 2);
+    reflowPrimaryScreen(oldGrid, primaryRows, rows, oldRows);
+
+    struct Screen old = replaceScreenRows(&renderContext.alternateScreen, oldGrid, rows, primaryRows);
+    if (oldGrid) {
+        for (int y = 0; y < rows && y < oldRows; y++) {
+            copyRow(oldGrid, old.rowMap[ringPosition(&old, y)], primaryRows + y);
+        }
+    }
+    free(old.rowMap);
+    freeGrid(oldGrid);
+
+    historyViewRow = primaryRows + rows;
+    historyViewIds = realloc(historyViewIds, rows * sizeof(long long));
+    for (int y = 0; y < rows; y++) {
+        historyViewIds[y] = HISTORY_ROW_NONE;
+    }
+    historyViewEnd = getHistoryEnd();
+    renderContext.scrollOffset = 0;
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+}
+
+/**
+ * Encodes the rows of the primary screen for a snapshot, see snapshot.h: the scrollback rows of the ring, oldest
+ * first, then the visible rows, each prefixed with its encoded size. The alternate screen is not saved, since the
+ * program drawing it does not outlive the session. Returns the size written to `*output`, which is grown as needed.
+*/
+int encodeScreen(unsigned char **output, int *capacity) {
+    const struct Screen *screen = &renderContext.primaryScreen;
+    struct CellGrid *grid = renderContext.grid;
+    int size = 0;
+    for (int y = -screen->scrollbackCount; y < renderContext.screenTileSize.y; y++) {
+        const int row = getScreenRow(screen, y);
+        const int wrapped = grid->wrapped[row];
+        const unsigned int *cells = readRow(grid, row);
+        int length = grid->blankFrom[row] == 0 && grid->blankCell[row] == 0 ? 0 : grid->columns;
+        while (!wrapped && length > 0 && cells[length - 1] == 0) length--;
+
+        const int maxSize = sizeof(int) + getEncodedRowBound(cells, length);
+        if (size + maxSize > *capacity) {
+            *capacity = (size + maxSize) * 2;
+            *output = realloc(*output, *capacity);
+        }
+        const int rowSize = encodeHistoryRow(cells, length, wrapped, *output + size + sizeof(int));
+        memcpy(*output + size, &rowSize, sizeof(int));
+        size += sizeof(int) + rowSize;
+    }
+    return size;
+}
+
+/**
+ * Fills the primary screen, which must be blank, with rows written by encodeScreen() at the current screen size.
+ * The newest rows become the visible rows, and older rows that do not fit in the scrollback of the ring are added
+ * to the history.
+*/
+void restoreScreen(const unsigned char *input, int size) {
+    struct Screen *screen = &renderContext.primaryScreen;
+    struct CellGrid *grid = renderContext.grid;
+    const int rows = renderContext.screenTileSize.y;
+    const int capacity = screen->rowCount - rows;
+    int count = 0;
+    for (int offset = 0; offset < size; count++) {
+        int rowSize;
+        memcpy(&rowSize, input + offset, sizeof(int));
+        offset += sizeof(int) + rowSize;
+    }
+
+    for (int y = rows - count; y < rows; y++) {
+        int rowSize;
+        memcpy(&rowSize, input, sizeof(int));
+        input += sizeof(int);
+        int wrapped;
+        const int length = getEncodedRowLength(input, &wrapped);
+        if (y < -capacity) {
+            if (length > rowBufferSize) {
+                rowBufferSize = length;
+                rowBuffer = realloc(rowBuffer, rowBufferSize * sizeof(unsigned int));
+            }
+            decodeHistoryRow(input, 0, rowBuffer, length);
+            appendHistoryRow(rowBuffer, length, wrapped);
+        } else {
+            const int row = getScreenRow(screen, y);
+            const int cells = length < grid->columns ? length : grid->columns;
+            decodeHistoryRow(input, 0, getWritableRow(row, cells), cells);
+            grid->wrapped[row] = wrapped;
+        }
+        input += rowSize;
+    }
+    screen->scrollbackCount = count - rows < capacity ? (count - rows > 0 ? count - rows : 0) : capacity;
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+}
+
+/**
+ * Sets the scroll region to screen rows [top, bottom]. Invalid regions are ignored.
+*/
+void setScrollRegion(int top, int bottom) {
+    if (top < 0 || bottom >= renderContext.screenTileSize.y || top >= bottom) {
+        return;
+    }
+
+    struct Screen *screen = renderContext.screen;
+    normalizeScrollRegion(screen);
+    screen->scrollRegionTop = top;
+    screen->scrollRegionBottom = bottom;
+}
+
+static void resetScreenScrollRegion(struct Screen *screen) {
+    normalizeScrollRegion(screen);
+    screen->scrollRegionTop = 0;
+    screen->scrollRegionBottom = renderContext.screenTileSize.y > 0 ? renderContext.screenTileSize.y - 1 : 0;
+}
+
+/**
+ * Resets the scroll regions of both screens to the full screen, such as after a resize.
+*/
+void resetScrollRegion() {
+    resetScreenScrollRegion(&renderContext.primaryScreen);
+    resetScreenScrollRegion(&renderContext.alternateScreen);
+}
+
+/**
+ * Stores the cursor position and colors, which are restored by restoreCursor(). Each screen has its own saved
+ * cursor.
+*/
+void saveCursor() {
+    struct Screen *screen = renderContext.screen;
+    screen->savedCursorPosition = renderContext.cursorPosition;
+    screen->savedForegroundColor = renderContext.foregroundColor;
+    screen->savedBackgroundColor = renderContext.backgroundColor;
+}
+
+void restoreCursor() {
+    struct Screen *screen = renderContext.screen;
+    renderContext.cursorPosition = screen->savedCursorPosition;
+    renderContext.wrapPending = 0;
+    renderContext.foregroundColor = screen->savedForegroundColor;
+    renderContext.backgroundColor = screen->savedBackgroundColor;
+
+    // The screen may have been resized since the cursor was saved.
+    if (renderContext.cursorPosition.x >= renderContext.screenTileSize.x) {
+        renderContext.cursorPosition.x = renderContext.screenTileSize.x - 1;
+    }
+    if (renderContext.cursorPosition.y >= renderContext.screenTileSize.y) {
+        renderContext.cursorPosition.y = renderContext.screenTileSize.y - 1;
+    }
+}
+
+/**
+ * Switches between the primary and alternate screens. Each screen has its own rows, so switching only changes
+ * the screen pointer; the primary screen and its scrollback are left untouched while the alternate screen is used.
+*/
+void useAlternateScreen(int enabled) {
+    struct Screen *screen = enabled ? &renderContext.alternateScreen : &renderContext.primaryScreen;
+    if (renderContext.screen == screen) {
+        return;
+    }
+
+    renderContext.screen = screen;
+    renderContext.scrollOffset = 0;
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+}
+
+int isAlternateScreen() {
+    return renderContext.screen == &renderContext.alternateScreen;
+}
+
+/**
+ * Moves a row of the primary screen's ring to the history, unless it is one of the rows already moved there by
+ * beginSkippedRows().
+*/
+static void archiveRingRow(int row, int nextRow) {
+    if (skippedRingRows > 0) {
+        skippedRingRows--;
+    } else {
+        archiveRow(renderContext.grid, row, nextRow);
+    }
+}
+
+/**
+ * Moves the rows that the ring is about to reuse for the next `count` rows at the bottom of the screen into the
+ * history, oldest first. These are the oldest scrollback rows, or rows leaving the screen once the ring has no
+ * room for more scrollback.
+*/
+static void archiveRows(struct Screen *screen, int count) {
+    const int capacity = screen->rowCount - renderContext.screenTileSize.y;
+    for (int i = 0; i < count; i++) {
+        // Rows above the screen, where 0 is screen row 0 and negative values are further down the screen.
+        const int distance = capacity - i;
+        if (distance <= screen->scrollbackCount) {
+            archiveRingRow(screen->rowMap[(screen->rowOffset - distance + screen->rowCount) % screen->rowCount],
+                           screen->rowMap[(screen->rowOffset - distance + 1 + screen->rowCount) % screen->rowCount]);
+        }
+    }
+
+    screen->scrollbackCount += count;
+    if (screen->scrollbackCount > capacity) {
+        screen->scrollbackCount = capacity;
+    }
+}
+
+/**
+ * Scrolls the contents of the scroll region up by `count` rows. When the region covers the whole screen the ring
+ * offset advances, so the rows leaving the top become scrollback and the rows they replace move to the history.
+ * Otherwise the region's rotation changes. Either way, only the rows exposed at the bottom are touched.
+*/
+void scrollUp(int count) {
+    struct Screen *screen = renderContext.screen;
+    const int top = screen->scrollRegionTop;
+    const int bottom = screen->scrollRegionBottom;
+    const int height = bottom - top + 1;
+    if (count > height) count = height;
+    if (count <= 0) return;
+
+    if (top == 0 && bottom == renderContext.screenTileSize.y - 1) {
+        normalizeScrollRegion(screen);
+        if (screen == &renderContext.primaryScreen) {
+            archiveRows(screen, count);
+        }
+        screen->rowOffset = (screen->rowOffset + count) % screen->rowCount;
+    } else {
+        screen->scrollRegionShift = (screen->scrollRegionShift + count) % height;
+    }
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+    clearRows(bottom - count + 1, bottom);
+}
+
+/**
+ * Scrolls the contents of the scroll region down by `count` rows, clearing the rows exposed at the top.
+*/
+void scrollDown(int count) {
+    struct Screen *screen = renderContext.screen;
+    const int top = screen->scrollRegionTop;
+    const int bottom = screen->scrollRegionBottom;
+    const int height = bottom - top + 1;
+    if (count > height) count = height;
+    if (count <= 0) return;
+
+    screen->scrollRegionShift = (screen->scrollRegionShift + height - count) % height;
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+    clearRows(top, top + count - 1);
+}
+
+/**
+ * Moves the cursor to the start of the next line. At the bottom of the scroll region the cursor stays put and the
+ * region scrolls up by one row.
+*/
+void lineFeed() {
+    renderContext.cursorPosition.x = 0;
+    renderContext.wrapPending = 0;
+
+    if (renderContext.cursorPosition.y == renderContext.screen->scrollRegionBottom) {
+        scrollUp(1);
+    } else if (renderContext.cursorPosition.y < renderContext.screenTileSize.y - 1) {
+        renderContext.cursorPosition.y += 1;
+    }
+}
+
+/**
+ * Starts writing lines straight to the history, for output that is known to scroll them out of the ring before
+ * anything else happens to the screen. Only possible at the start of an empty row at the bottom of the primary
+ * screen, with nothing scrolled back; returns 0 otherwise.
+ *
+ * Every row of the ring above the cursor would reach the history before the first skipped row, so they are moved
+ * there now and the ring skips them as it reuses their positions, see endSkippedRows(). The skipped rows are then
+ * built outside the grid, so they are never uploaded or looked at by the glyph cache.
+*/
+int beginSkippedRows() {
+    struct Screen *screen = renderContext.screen;
+    struct CellGrid *grid = renderContext.grid;
+    const int rows = renderContext.screenTileSize.y;
+    const int bottom = getStorageRow(rows - 1);
+    if (screen != &renderContext.primaryScreen || screen->scrollRegionTop != 0 || screen->scrollRegionBottom != rows - 1
+            || renderContext.cursorPosition.y != rows - 1 || renderContext.cursorPosition.x != 0
+            || renderContext.wrapPending || renderContext.scrollOffset != 0 || grid->blankFrom[bottom] != 0) {
+        return 0;
+    }
+
+    for (int y = -screen->scrollbackCount; y < rows - 1; y++) {
+        archiveRingRow(getScreenRow(screen, y), getScreenRow(screen, y + 1));
+    }
+
+    if (grid->columns > skippedRow.capacity) {
+        skippedRow.capacity = grid->columns;
+        skippedRow.cells = realloc(skippedRow.cells, skippedRow.capacity * sizeof(unsigned int));
+    }
+    skippedRow.written = 0;
+    skippedRow.blank = grid->blankCell[bottom];
+    skippedRow.wrapped = grid->wrapped[bottom];
+    skippedRow.x = 0;
+    skippedRow.completed = 0;
+    return 1;
+}
+
+/**
+ * Moves the skipped row to the history and starts the next one, erased the way scrolling would erase it.
+*/
+static void completeSkippedRow() {
+    const int columns = renderContext.grid->columns;
+    if (skippedRow.written == 0 && skippedRow.blank == 0) {
+        appendHistoryRow(0, 0, 0);
+    } else {
+        for (int x = skippedRow.written; x < columns; x++) {
+            skippedRow.cells[x] = skippedRow.blank;
+        }
+        appendHistoryRow(skippedRow.cells, columns, skippedRow.wrapped);
+    }
+
+    skippedRow.written = 0;
+    skippedRow.blank = packCell(0, getBlankStyle());
+    skippedRow.wrapped = 0;
+    skippedRow.x = 0;
+    skippedRow.completed++;
+}
+
+/**
+ * Prints `count` printable ASCII characters to the skipped row, wrapping like printCharacter().
+*/
+void printSkippedText(const unsigned char *text, int count) {
+    const int columns = renderContext.grid->columns;
+    const int style = getCurrentStyle();
+    while (count > 0) {
+        if (skippedRow.x == columns) {
+            skippedRow.wrapped = 1;
+            completeSkippedRow();
+        }
+        const int x = skippedRow.x;
+        const int run = count < columns - x ? count : columns - x;
+        for (int i = skippedRow.written; i < x; i++) {
+            skippedRow.cells[i] = skippedRow.blank;
+        }
+        for (int i = 0; i < run; i++) {
+            skippedRow.cells[x + i] = packCell(text[i], style);
+        }
+        if (x + run > skippedRow.written) skippedRow.written = x + run;
+        renderContext.lastCharacter = text[run - 1];
+
+        text += run;
+        count -= run;
+        skippedRow.x += run;
+    }
+}
+
+void skippedCarriageReturn() {
+    skippedRow.x = 0;
+}
+
+void skippedLineFeed() {
+    completeSkippedRow();
+}
+
+/**
+ * Stops skipping lines, after a line feed. The ring is left as it would be after scrolling once for each skipped
+ * row, except that the rows above the cursor are already in the history: the positions that would hold them are
+ * skipped when the ring archives them, which the output still to come does before the next frame.
+*/
+void endSkippedRows() {
+    struct Screen *screen = renderContext.screen;
+    const int rows = renderContext.screenTileSize.y;
+    const int capacity = screen->rowCount - rows;
+    screen->scrollbackCount += skippedRow.completed;
+    if (screen->scrollbackCount > capacity) {
+        screen->scrollbackCount = capacity;
+    }
+    skippedRingRows = screen->scrollbackCount + rows - 1;
+    eraseCells(getStorageRow(rows - 1), 0, renderContext.grid->columns);
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+}
+
+/**
+ * Adds a combining character to the cluster of the cell before the cursor, or of the cell under it while a wrap is
+ * pending. A combining character with no character to attach to is dropped.
+*/
+static void combineCharacter(int codePoint) {
+    struct CellGrid *grid = renderContext.grid;
+    int x = renderContext.wrapPending ? renderContext.cursorPosition.x : renderContext.cursorPosition.x - 1;
+    if (x < 0) {
+        return;
+    }
+
+    const int row = getStorageRow(renderContext.cursorPosition.y);
+    unsigned int *cells = &grid->cells[row * grid->columns];
+    if (x > 0 && x < grid->blankFrom[row] && (cells[x] & CELL_SPACER)) {
+        x--;
+    }
+    if (x >= grid->blankFrom[row]) {
+        return;
+    }
+    const int glyph = (cells[x] >> CELL_GLYPH_SHIFT) & CELL_GLYPH_MASK;
+    if (glyph == GLYPH_BLANK) {
+        return;
+    }
+
+    const int key = getGlyphKey(glyph);
+    const int cluster = addToCluster(key & ~(GLYPH_LEFT_HALF | GLYPH_RIGHT_HALF), codePoint);
+    const int style = cells[x] >> CELL_STYLE_SHIFT;
+    if (cells[x] & CELL_WIDE) {
+        cells[x] = packCell(getGlyphId(cluster | GLYPH_LEFT_HALF), style) | CELL_WIDE;
+        cells[x + 1] = packCell(getGlyphId(cluster | GLYPH_RIGHT_HALF), style) | CELL_SPACER;
+        markCellsDirty(row, x, x + 2);
+    } else {
+        cells[x] = packCell(getGlyphId(cluster), style);
+        markCellsDirty(row, x, x + 1);
+    }
+}
+
+/**
+ * Moves the cursor to the start of the next row if a wrap is pending, marking the row it leaves as wrapped onto it.
+*/
+static void wrapPendingLine() {
+    if (renderContext.wrapPending) {
+        renderContext.grid->wrapped[getStorageRow(renderContext.cursorPosition.y)] = 1;
+        lineFeed();
+    }
+}
+
+/**
+ * Leaves the cursor after `count` cells printed from its column, or in the last column with a wrap pending if they
+ * reached the end of the row.
+*/
+static void advanceCursor(int count) {
+    renderContext.cursorPosition.x += count;
+    if (renderContext.cursorPosition.x >= renderContext.screenTileSize.x) {
+        renderContext.cursorPosition.x = renderContext.screenTileSize.x - 1;
+        renderContext.wrapPending = 1;
+    }
+}
+
+/**
+ * Prints a double-width character as the left half of its glyph followed by a spacer cell with the right half. A
+ * character that does not fit before the end of the row is moved to the next row, leaving the last column blank.
+*/
+static void printWideCharacter(int codePoint) {
+    if (renderContext.screenTileSize.x < 2) {
+        return;
+    }
+    wrapPendingLine();
+    int row = getStorageRow(renderContext.cursorPosition.y);
+    if (renderContext.cursorPosition.x == renderContext.screenTileSize.x - 1) {
+        eraseCells(row, renderContext.cursorPosition.x, 1);
+        renderContext.grid->wrapped[row] = 1;
+        lineFeed();
+        row = getStorageRow(renderContext.cursorPosition.y);
+    }
+
+    const int x = renderContext.cursorPosition.x;
+    const int style = getCurrentStyle();
+    splitWideCharacters(row, x, x + 2);
+    unsigned int *cells = getWritableRow(row, x + 2) + x;
+    cells[0] = packCell(getGlyphId(codePoint | GLYPH_LEFT_HALF), style) | CELL_WIDE;
+    cells[1] = packCell(getGlyphId(codePoint | GLYPH_RIGHT_HALF), style) | CELL_SPACER;
+    markCellsDirty(row, x, x + 2);
+    renderContext.lastCharacter = codePoint;
+    advanceCursor(2);
+}
+
+void printCharacter(int codePoint) {
+    // Reset scroll offset to jump back to current line when there are printed characters.
+    if (renderContext.scrollOffset != 0) {
+        renderContext.scrollOffset = 0;
+        renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+    }
+
+    const int width = getCodepointWidth(codePoint);
+    if (width == 0) {
+        combineCharacter(codePoint);
+        return;
+    }
+    if (width == 2) {
+        printWideCharacter(codePoint);
+        return;
+    }
+
+    wrapPendingLine();
+    const int row = getStorageRow(renderContext.cursorPosition.y);
+    const int x = renderContext.cursorPosition.x;
+    splitWideCharacters(row, x, x + 1);
+    getWritableRow(row, x + 1)[x] = packCell(getGlyphId(codePoint), getCurrentStyle());
+    markCellsDirty(row, x, x + 1);
+    renderContext.lastCharacter = codePoint;
+    advanceCursor(1);
+}
+
+/**
+ * Prints the last printed character `count` more times. The glyph is looked up once and written as one run
+ * per row.
+*/
+void repeatCharacter(int count) {
+    if (renderContext.lastCharacter < 0) {
+        return;
+    }
+    if (getCodepointWidth(renderContext.lastCharacter) == 2) {
+        for (int i = 0; i < count; i++) {
+            printWideCharacter(renderContext.lastCharacter);
+        }
+        return;
+    }
+
+    const unsigned int cell = packCell(getGlyphId(renderContext.lastCharacter), getCurrentStyle());
+    while (count > 0) {
+        wrapPendingLine();
+        const int x = renderContext.cursorPosition.x;
+        const int run = count < renderContext.screenTileSize.x - x ? count : renderContext.screenTileSize.x - x;
+        const int row = getStorageRow(renderContext.cursorPosition.y);
+        splitWideCharacters(row, x, x + run);
+        unsigned int *cells = getWritableRow(row, x + run) + x;
+        for (int i = 0; i < run; i++) {
+            cells[i] = cell;
+        }
+        markCellsDirty(row, x, x + run);
+
+        count -= run;
+        advanceCursor(run);
+    }
+}
+
+void eraseScreenRect(int xStart, int xEnd, int yStart, int yEnd) {
+    if (xStart > xEnd) {
+        return;
+    }
+    for (int y = yStart; y <= yEnd; y++) {
+        eraseCells(getStorageRow(y), xStart, xEnd - xStart + 1);
+    }
+}
+
+void insertLines(int count) {
+    struct Screen *screen = renderContext.screen;
+    const int y = renderContext.cursorPosition.y;
+    const int bottom = screen->scrollRegionBottom;
+    if (y < screen->scrollRegionTop || y > bottom) return;
+    if (count > bottom - y + 1) count = bottom - y + 1;
+    if (count <= 0) return;
+
+    normalizeScrollRegion(screen);
+    rotateRowsDown(screen, y, bottom, count);
+    clearRows(y, y + count - 1);
+    renderContext.cursorPosition.x = 0;
+}
+
+void deleteLines(int count) {
+    struct Screen *screen = renderContext.screen;
+    const int y = renderContext.cursorPosition.y;
+    const int bottom = screen->scrollRegionBottom;
+    if (y < screen->scrollRegionTop || y > bottom) return;
+    if (count > bottom - y + 1) count = bottom - y + 1;
+    if (count <= 0) return;
+
+    normalizeScrollRegion(screen);
+    rotateRowsDown(screen, y, bottom, bottom - y + 1 - count);
+    clearRows(bottom - count + 1, bottom);
+    renderContext.cursorPosition.x = 0;
+}
+
+/**
+ * Shifts the cells in [x, end of line) of the cursor row by `distance` columns using a single move. Cells
+ * shifted past the end of the line are discarded. Double-width characters cut in two by the shift lose their other
+ * half: one at column x when inserting, one at either end of the deleted cells, and one shifted into the last column
+ * without its right half.
+*/
+static void shiftCells(int x, int distance) {
+    const int columns = renderContext.screenTileSize.x;
+    const int row = getStorageRow(renderContext.cursorPosition.y);
+    unsigned int *cells = getWritableRow(row, columns);
+    markCellsDirty(row, x, columns);
+
+    if (distance > 0) {
+        splitWideCharacters(row, x, x);
+        memmove(&cells[x + distance], &cells[x], (columns - x - distance) * sizeof(unsigned int));
+        if (cells[columns - 1] & CELL_WIDE) {
+            cells[columns - 1] &= ~CELL_CONTENT_MASK;
+        }
+    } else {
+        splitWideCharacters(row, x, x - distance);
+        memmove(&cells[x], &cells[x - distance], (columns - x + distance) * sizeof(unsigned int));
+    }
+}
+
+void insertCharacters(int count) {
+    const int x = renderContext.cursorPosition.x;
+    const int columns = renderContext.screenTileSize.x;
+    if (count > columns - x) count = columns - x;
+    if (count <= 0) return;
+
+    shiftCells(x, count);
+    eraseScreenRect(x, x + count - 1, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
+}
+
+void deleteCharacters(int count) {
+    const int x = renderContext.cursorPosition.x;
+    const int columns = renderContext.screenTileSize.x;
+    if (count > columns - x) count = columns - x;
+    if (count <= 0) return;
+
+    shiftCells(x, -count);
+    eraseScreenRect(columns - count, columns - 1, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
+}
+
+void eraseCharacters(int count) {
+    const int x = renderContext.cursorPosition.x;
+    const int columns = renderContext.screenTileSize.x;
+    if (count > columns - x) count = columns - x;
+    if (count <= 0) return;
+
+    eraseScreenRect(x, x + count - 1, renderContext.cursorPosition.y, renderContext.cursorPosition.y);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+void initScreen();
+void freeScreen();
+void resizeScreen(int columns, int rows);
+int getStorageRow(int y);
+int getScrollbackRows();
+void clearScrollback();
+void getDisplayedRows(struct ShaderRow *rows);
+void updateShaderRowMap();
+unsigned int getDisplayedCell(int x, int y);
+int encodeScreen(unsigned char **output, int *capacity);
+void restoreScreen(const unsigned char *input, int size);
+void setScrollRegion(int top, int bottom);
+void resetScrollRegion();
+void saveCursor();
+void restoreCursor();
+void useAlternateScreen(int enabled);
+int isAlternateScreen();
+void scrollUp(int count);
+void scrollDown(int count);
+void lineFeed();
+int beginSkippedRows();
+void printSkippedText(const unsigned char *text, int count);
+void skippedCarriageReturn();
+void skippedLineFeed();
+void endSkippedRows();
+void printCharacter(int codePoint);
+void repeatCharacter(int count);
+void eraseScreenRect(int xStart, int xEnd, int yStart, int yEnd);
+void insertLines(int count);
+void deleteLines(int count);
+void insertCharacters(int count);
+void deleteCharacters(int count);
+void eraseCharacters(int count);
@@ -1,25 +1,47 @@
 #version 430
 
-#define MAX_CHARACTERS_PER_ROW 500
-#define MAX_ROWS 1000
-#define ATLAS_WIDTH 32
-#define ATLAS_HEIGHT 32
+// The atlas, palette, style and glyph table sizes and the cell and style layouts (CELL_*, STYLE_*) are defined by
+// compileShader() from the C headers.
 
 layout(std430, binding = 2) buffer TextShaderContext {
-    int glyphIndicesRowOffset;
     ivec2 atlasGlyphSize;
     ivec2 screenGlyphSize;
     ivec2 screenSize;
     ivec2 screenTileSize;
     ivec2 screenExcess;
-    uint glyphIndices[MAX_CHARACTERS_PER_ROW * MAX_ROWS];
-    uint glyphColors[MAX_CHARACTERS_PER_ROW * MAX_ROWS];
+    int palette[PALETTE_SIZE];
+    uint styles[STYLE_TABLE_SIZE];
+    uint glyphSlots[GLYPH_TABLE_SIZE];
+    uint cells[];
 } context;
 
+// Row of the cells displayed at each screen row. Cells from blankFrom on were erased without being written, and
+// are drawn as the blank cell instead.
+struct ShaderRow {
+    int row;
+    int blankFrom;
+    uint blank;
+};
+
+layout(std430, binding = 3) buffer RowMap {
+    ShaderRow rowMap[];
+};
+
+// Number of cells in each row of the cells array.
+uniform int gridColumns;
+
 uniform sampler2D glyphTexture;
 uniform vec2 windowPadding;
 out vec4 outColor;
 
+vec3 unpackColor(int color) {
+    return vec3(
+        float((color >> 16) & 0xFF) / 0xFF,
+        float((color >> 8) & 0xFF) / 0xFF,
+        float((color >> 0) & 0xFF) / 0xFF
+    );
+}
+
 void main() {
     vec2 screenPosition = vec2(
         gl_FragCoord.x - windowPadding.x,
@@ -47,24 +69,34 @@ void main() {
     );
 
     // 1d index of tile.
-    int tileIndex = (int(mod(tile.y + context.glyphIndicesRowOffset, MAX_ROWS))) * MAX_CHARACTERS_PER_ROW + tile.x;
+    ShaderRow row = rowMap[clamp(tile.y, 0, context.screenTileSize.y - 1)];
+    int column = clamp(tile.x, 0, gridColumns - 1);
+    int tileIndex = row.row * gridColumns + column;
 
-    // Find 2d tile coordinates of the corresponding glyph.
-    uint glyphIndex = context.glyphIndices[tileIndex];
+    // Find 2d tile coordinates of the atlas position of the cell's glyph.
+    uint cell = column >= row.blankFrom ? row.blank : context.cells[tileIndex];
+    uint glyphIndex = context.glyphSlots[(cell >> CELL_GLYPH_SHIFT) & uint(CELL_GLYPH_MASK)];
     ivec2 glyphTile = ivec2(mod(glyphIndex, atlasTileSize.x), floor(glyphIndex / atlasTileSize.x));
 
     // Convert tile coordinate into the actual coordinate within glyph texture.
     vec2 tileOffset = mod(pixelPosition.xy, context.screenGlyphSize) / vec2(context.screenGlyphSize);
     vec2 glyphCoordinate = ((glyphTile * context.atlasGlyphSize) + (tileOffset * context.atlasGlyphSize)) / glyphTextureSize;
 
+    // Look up the cell's style, then its foreground and background colors in the palette. Background index 0 is
+    // the default background, which is left to the clear color.
+    uint style = context.styles[(cell >> CELL_STYLE_SHIFT) & uint(CELL_STYLE_MASK)];
+    uint foregroundIndex = (style >> STYLE_FOREGROUND_SHIFT) & uint(STYLE_COLOR_MASK);
+    uint backgroundIndex = (style >> STYLE_BACKGROUND_SHIFT) & uint(STYLE_COLOR_MASK);
+    vec3 textColor = unpackColor(context.palette[foregroundIndex]);
+
     // Sample the glyph atlas to set pixel color.
-    vec3 textColor = vec3(
-        float((context.glyphColors[tileIndex] >> 16) & 0xFF) / 0xFF,
-        float((context.glyphColors[tileIndex] >> 8) & 0xFF) / 0xFF,
-        float((context.glyphColors[tileIndex] >> 0) & 0xFF) / 0xFF
-    );
-    vec4 glyphSample = vec4(1.0, 1.0, 1.0, texture(glyphTexture, glyphCoordinate).r);
-    outColor = vec4(textColor, 1.0) * glyphSample * outOfBoundsMask;
+    float glyphAlpha = texture(glyphTexture, glyphCoordinate).r;
+    if (backgroundIndex == 0u) {
+        outColor = vec4(textColor, glyphAlpha) * outOfBoundsMask;
+    } else {
+        vec3 backgroundColor = unpackColor(context.palette[backgroundIndex]);
+        outColor = vec4(mix(backgroundColor, textColor, glyphAlpha), 1.0) * outOfBoundsMask;
+    }
 
     // Background checker pattern
     int render_checkered_background = 0;
@@ -80,6 +112,6 @@ void main() {
     // outColor = vec4(glyphTile.x / float(atlasTileSize.x), glyphTile.y / float(atlasTileSize.y), 0.0, 1.0);
     // outColor = vec4(tileOffset.x, tileOffset.y, 0.0, 1.0);
     // outColor = vec4(outOfBoundsMask, 0, 0, 1.0);
-    // if (outColor.a == 0) outColor = vec4(0, tileIndex / float(MAX_CHARACTERS_PER_ROW) / 50, 0.0, 1.0);
+    // if (outColor.a == 0) outColor = vec4(0, tileIndex / float(gridColumns) / 50, 0.0, 1.0);
     // outColor = vec4(texture(glyphTexture, gl_FragCoord.xy / context.screenSize.xy).r, 0.0, 0.0, 1.0);
 };
@@ -0,0 +1,604 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "terminal.h"
+#include "history.h"
+#include "screen.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC 0x50414E53
+#define SNAPSHOT_VERSION 3
+// Largest screen a snapshot is restored at, anything larger is taken as a damaged file.
+#define SNAPSHOT_MAX_SCREEN 4096
+
+/**
+ * Where a state record is in the file, and the hash of its bytes. A size of 0 stands for no record.
+*/
+struct SnapshotStateRecord {
+    long long offset;
+    int size;
+    unsigned int hash;
+};
+
+/**
+ * Start of the file, pointing at the newest state record and the one before it. It is written only once the
+ * records and blocks it points at are on disk, so a crash while the snapshot is updated leaves it pointing at the
+ * previous states. Should a record still be damaged, the hash catches it and the previous record is used instead.
+*/
+struct SnapshotHeader {
+    unsigned int magic;
+    unsigned int version;
+    struct SnapshotStateRecord states[2];
+};
+
+/**
+ * Start of a state record. The blocks of the history, the rows of the history's open block and the rows of the
+ * primary screen follow it in that order. Rows store their 24-bit colors by value, see encodeHistoryRow().
+*/
+struct SnapshotState {
+    struct Vec2i screenSize;
+    struct Vec2i cursorPosition;
+    int blockCount;
+    int openRows;
+    int openSize;
+    int screenRowsSize;
+};
+
+/**
+ * A compressed history block stored in the file.
+*/
+struct SnapshotBlock {
+    long long offset;
+    int size;
+    int rawSize;
+    unsigned int hash;
+};
+
+/**
+ * Bytes the writer puts at `offset` in the file. They are taken from the copied block data at `dataOffset`, or, when
+ * `source` is not -1, from that offset in the old file being compacted.
+*/
+struct SnapshotPiece {
+    long long offset;
+    long long source;
+    long long dataOffset;
+    int size;
+};
+
+/**
+ * An update of the file, filled in by updateSnapshot() and carried out by the writer thread: the pieces and the
+ * state record are written, then the header is pointed at the record. When compacting, `fd` is the new file, which
+ * is moved over the old one, `previousFd`, once complete. The frame loop leaves it alone until the writer is done.
+*/
+struct SnapshotWrite {
+    int fd;
+    int previousFd;
+    char newPath[PATH_MAX];
+    struct SnapshotPiece *pieces;
+    int pieceCount;
+    int pieceCapacity;
+    unsigned char *data;
+    long long dataSize;
+    long long dataCapacity;
+    long long stateOffset;
+    struct SnapshotHeader header;
+    int failed;
+};
+
+static int snapshotFd = -1;
+static char *snapshotPath;
+static long long fileSize;
+// Bytes of the file the newest state refers to, the rest are left over from blocks and states replaced since.
+static long long liveSize;
+// Blocks in the file, along with the serial of the history block each one holds, oldest first.
+static struct SnapshotBlock *blocks;
+static long long *serials;
+static int blockCount;
+static int blockCapacity;
+static unsigned char *state;
+static int stateSize;
+// The state record the header points at as the newest.
+static struct SnapshotStateRecord stateRecord;
+static unsigned char *screenRows;
+static int screenRowsCapacity;
+static double lastUpdate;
+static struct SnapshotWrite pending = { .previousFd = -1 };
+static pthread_t writer;
+static int writerStarted;
+// Set while the writer thread is busy with `pending`.
+static atomic_int writing;
+
+extern struct RenderContext renderContext;
+
+static unsigned int hashBytes(const unsigned char *data, long long size) {
+    unsigned int hash = 2166136261u;
+    for (long long i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static double getTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int writeAt(int fd, const void *data, long long size, long long offset) {
+    const char *bytes = data;
+    while (size > 0) {
+        const ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written <= 0) {
+            return 0;
+        }
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+    return 1;
+}
+
+/**
+ * Opens and locks the snapshot file at `path`, creating it if needed. Only one terminal uses the snapshot, later
+ * ones run without one.
+*/
+static int openSnapshotFile(const char *path, int flags) {
+    const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | flags, 0600);
+    if (fd < 0) {
+        printf("Failed to open snapshot %s, the session will not be saved.\n", path);
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        printf("Snapshot %s is used by another terminal, the session will not be saved.\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Returns the path of the snapshot in $XDG_STATE_HOME, or in ~/.local/state when it is not set.
+*/
+static char *getSnapshotPath() {
+    const char *stateHome = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    char *path = malloc(PATH_MAX);
+    if (stateHome && stateHome[0]) {
+        snprintf(path, PATH_MAX, "%s", stateHome);
+    } else if (home) {
+        snprintf(path, PATH_MAX, "%s/.local/state", home);
+    } else {
+        free(path);
+        return 0;
+    }
+    mkdir(path, 0700);
+
+    const size_t length = strlen(path);
+    snprintf(path + length, PATH_MAX - length, "/terminal-snapshot");
+    return path;
+}
+
+static void addBlock(struct SnapshotBlock block, long long serial) {
+    if (blockCount == blockCapacity) {
+        blockCapacity = blockCapacity > 0 ? blockCapacity * 2 : 64;
+        blocks = realloc(blocks, blockCapacity * sizeof(struct SnapshotBlock));
+        serials = realloc(serials, blockCapacity * sizeof(long long));
+    }
+    blocks[blockCount] = block;
+    serials[blockCount] = serial;
+    blockCount++;
+}
+
+/**
+ * Checks a state record of a mapped snapshot file and, if it is intact, restores the history and the primary screen
+ * from it. Returns 0, without changing anything, if the record cannot be used.
+*/
+static int loadState(const unsigned char *file, long long size, struct SnapshotStateRecord record) {
+    if (record.offset < (long long) sizeof(struct SnapshotHeader) || record.size < (int) sizeof(struct SnapshotState)
+        || record.offset + record.size > size || hashBytes(file + record.offset, record.size) != record.hash) {
+        return 0;
+    }
+
+    const unsigned char *data = file + record.offset;
+    struct SnapshotState saved;
+    memcpy(&saved, data, sizeof(saved));
+    data += sizeof(saved);
+    const long long expectedSize = sizeof(saved) + (long long) saved.blockCount * sizeof(struct SnapshotBlock)
+        + saved.openSize + saved.screenRowsSize;
+    if (saved.blockCount < 0 || saved.openSize < 0 || saved.screenRowsSize < 0 || expectedSize != record.size
+        || saved.screenSize.x < 1 || saved.screenSize.x > SNAPSHOT_MAX_SCREEN
+        || saved.screenSize.y < 1 || saved.screenSize.y > SNAPSHOT_MAX_SCREEN) {
+        return 0;
+    }
+    const unsigned char *savedBlocks = data;
+    for (int i = 0; i < saved.blockCount; i++) {
+        struct SnapshotBlock block;
+        memcpy(&block, savedBlocks + i * sizeof(block), sizeof(block));
+        if (block.offset < (long long) sizeof(struct SnapshotHeader) || block.size <= 0
+            || block.offset + block.size > record.offset
+            || hashBytes(file + block.offset, block.size) != block.hash) {
+            return 0;
+        }
+    }
+    data += saved.blockCount * sizeof(struct SnapshotBlock);
+
+    // The rows are restored at the size they were saved at and then reflowed to the size of the window.
+    const struct Vec2i screenSize = renderContext.screenTileSize;
+    resizeScreen(saved.screenSize.x, saved.screenSize.y);
+    renderContext.screenTileSize = saved.screenSize;
+
+    for (int i = 0; i < saved.blockCount; i++) {
+        struct SnapshotBlock block;
+        memcpy(&block, savedBlocks + i * sizeof(block), sizeof(block));
+        addBlock(block, addHistoryBlock(file + block.offset, block.size, block.rawSize));
+    }
+    setOpenHistoryRows(data, saved.openSize, saved.openRows);
+    data += saved.openSize;
+    restoreScreen(data, saved.screenRowsSize);
+
+    const struct Vec2i cursor = saved.cursorPosition;
+    const int cursorOnScreen = cursor.x >= 0 && cursor.x < saved.screenSize.x
+        && cursor.y >= 0 && cursor.y < saved.screenSize.y;
+    renderContext.cursorPosition = cursorOnScreen ? cursor : (struct Vec2i) { 0, saved.screenSize.y - 1 };
+    resizeScreen(screenSize.x, screenSize.y);
+    renderContext.screenTileSize = screenSize;
+    resetScrollRegion();
+
+    // The shell of the restored session is a new one, so its output starts on a line of its own.
+    if (renderContext.cursorPosition.x > 0) {
+        lineFeed();
+    }
+    stateRecord = record;
+    return 1;
+}
+
+/**
+ * Restores the session from the newest intact state of a mapped snapshot file. Returns 0 if the file holds no
+ * usable state.
+*/
+static int loadSnapshot(const unsigned char *file, long long size) {
+    struct SnapshotHeader header;
+    memcpy(&header, file, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION) {
+        return 0;
+    }
+    if (loadState(file, size, header.states[0])) {
+        printf("Restored session from %s.\n", snapshotPath);
+        return 1;
+    }
+    if (loadState(file, size, header.states[1])) {
+        printf("Restored session from %s, without the last changes to it, which were damaged.\n", snapshotPath);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Moves a snapshot that could not be restored out of the way, so that it is kept as it is, and starts a new one.
+*/
+static void replaceDamagedSnapshot() {
+    char damagedPath[PATH_MAX];
+    snprintf(damagedPath, sizeof(damagedPath), "%s.damaged", snapshotPath);
+    if (rename(snapshotPath, damagedPath) != 0) {
+        printf("Failed to move damaged snapshot %s aside, the session will not be saved.\n", snapshotPath);
+        close(snapshotFd);
+        snapshotFd = -1;
+        return;
+    }
+    printf("Moved damaged snapshot %s to %s.\n", snapshotPath, damagedPath);
+    close(snapshotFd);
+    snapshotFd = openSnapshotFile(snapshotPath, O_TRUNC);
+}
+
+/**
+ * Restores the session saved in the snapshot, if there is one, and takes over the snapshot for this session. Must be
+ * called once the screen has been sized for the window and before the shell writes to it.
+*/
+void restoreSnapshot() {
+    snapshotPath = getSnapshotPath();
+    if (!snapshotPath) {
+        return;
+    }
+    snapshotFd = openSnapshotFile(snapshotPath, 0);
+    if (snapshotFd < 0) {
+        return;
+    }
+
+    struct stat status;
+    fileSize = fstat(snapshotFd, &status) == 0 ? status.st_size : 0;
+    int loaded = 0;
+    if (fileSize >= (long long) sizeof(struct SnapshotHeader)) {
+        unsigned char *file = mmap(0, fileSize, PROT_READ, MAP_PRIVATE, snapshotFd, 0);
+        if (file != MAP_FAILED) {
+            loaded = loadSnapshot(file, fileSize);
+            munmap(file, fileSize);
+        }
+        if (!loaded) {
+            replaceDamagedSnapshot();
+        }
+    }
+    if (!loaded) {
+        blockCount = 0;
+        fileSize = sizeof(struct SnapshotHeader);
+    }
+    liveSize = fileSize;
+    lastUpdate = getTime();
+}
+
+/**
+ * Stops saving the session after a write failed. A new file that was being written is removed, and the previous
+ * file is left as it was.
+*/
+static void disableSnapshot(int previousFd, const char *newPath) {
+    printf("Failed to write snapshot %s, the session will no longer be saved.\n", snapshotPath);
+    close(snapshotFd);
+    snapshotFd = -1;
+    if (previousFd >= 0) {
+        unlink(newPath);
+        close(previousFd);
+    }
+}
+
+static int copyAt(int fd, int sourceFd, long long size, long long source, long long offset) {
+    char buffer[64 * 1024];
+    while (size > 0) {
+        const long long chunk = size < (long long) sizeof(buffer) ? size : (long long) sizeof(buffer);
+        const ssize_t count = pread(sourceFd, buffer, chunk, source);
+        if (count <= 0 || !writeAt(fd, buffer, count, offset)) {
+            return 0;
+        }
+        size -= count;
+        source += count;
+        offset += count;
+    }
+    return 1;
+}
+
+static void addPiece(struct SnapshotPiece piece) {
+    if (pending.pieceCount == pending.pieceCapacity) {
+        pending.pieceCapacity = pending.pieceCapacity > 0 ? pending.pieceCapacity * 2 : 64;
+        pending.pieces = realloc(pending.pieces, pending.pieceCapacity * sizeof(struct SnapshotPiece));
+    }
+    pending.pieces[pending.pieceCount++] = piece;
+}
+
+/**
+ * Adds a copy of a block closed since the last update to the pending write. The history may drop or spill the block
+ * while the writer runs, so its bytes are copied rather than pointed at.
+*/
+static void addBlockData(const unsigned char *data, int size, long long offset) {
+    if (pending.dataSize + size > pending.dataCapacity) {
+        pending.dataCapacity = pending.dataCapacity > 0 ? pending.dataCapacity * 2 : 64 * 1024;
+        while (pending.dataCapacity < pending.dataSize + size) pending.dataCapacity *= 2;
+        pending.data = realloc(pending.data, pending.dataCapacity);
+    }
+    memcpy(pending.data + pending.dataSize, data, size);
+    addPiece((struct SnapshotPiece) { .offset = offset, .source = -1, .dataOffset = pending.dataSize, .size = size });
+    pending.dataSize += size;
+}
+
+/**
+ * Writer thread, carries out `pending`. Syncing the file can take a long time on a slow disk, and compacting
+ * rewrites all of it, so none of this happens in the frame loop.
+*/
+static void *writeSnapshot(void *argument) {
+    (void) argument;
+    struct SnapshotWrite *job = &pending;
+    int written = 1;
+    for (int i = 0; i < job->pieceCount && written; i++) {
+        const struct SnapshotPiece piece = job->pieces[i];
+        written = piece.source >= 0 ? copyAt(job->fd, job->previousFd, piece.size, piece.source, piece.offset)
+            : writeAt(job->fd, job->data + piece.dataOffset, piece.size, piece.offset);
+    }
+    // The blocks and the state must be on disk before the header points at them, and a new file must be complete
+    // before it replaces the old one.
+    job->failed = !written || !writeAt(job->fd, state, stateSize, job->stateOffset) || fdatasync(job->fd) != 0
+        || !writeAt(job->fd, &job->header, sizeof(job->header), 0)
+        || (job->previousFd >= 0 && fdatasync(job->fd) != 0);
+    if (!job->failed && job->previousFd >= 0) {
+        if (rename(job->newPath, snapshotPath) != 0) {
+            printf("Failed to replace snapshot %s.\n", snapshotPath);
+        }
+        close(job->previousFd);
+        job->previousFd = -1;
+    }
+    atomic_store(&writing, 0);
+    return 0;
+}
+
+/**
+ * Waits for the writer thread to finish the pending write, if one was started. Returns 0 if the write failed.
+*/
+static int waitForSnapshotWrite() {
+    if (!writerStarted) {
+        return 1;
+    }
+    pthread_join(writer, 0);
+    writerStarted = 0;
+    return !pending.failed;
+}
+
+/**
+ * Appends the history blocks closed since the last update and a new state record, then points the header at it.
+ * Only runs every SNAPSHOT_INTERVAL seconds, and writes nothing when the state has not changed. Once most of the
+ * file is left over from replaced states and dropped blocks, a new file is written and moved over the old one.
+ *
+ * Only the new blocks and the state record are copied here, the writing itself is left to the writer thread. An
+ * update is skipped while the previous one is still being written, and the bookkeeping of the file is updated as if
+ * the write had already succeeded; if it fails, the snapshot is disabled on the next update.
+*/
+void updateSnapshot() {
+    if (snapshotFd < 0 || atomic_load(&writing) || getTime() - lastUpdate < SNAPSHOT_INTERVAL) {
+        return;
+    }
+    lastUpdate = getTime();
+    if (!waitForSnapshotWrite()) {
+        disableSnapshot(pending.previousFd, pending.newPath);
+        return;
+    }
+    pending.pieceCount = 0;
+    pending.dataSize = 0;
+
+    int previousFd = -1;
+    char newPath[PATH_MAX];
+    if (fileSize - liveSize > SNAPSHOT_COMPACT_SIZE && fileSize - liveSize > liveSize) {
+        snprintf(newPath, sizeof(newPath), "%s.new", snapshotPath);
+        const int fd = openSnapshotFile(newPath, O_TRUNC);
+        if (fd >= 0) {
+            previousFd = snapshotFd;
+            snapshotFd = fd;
+            fileSize = sizeof(struct SnapshotHeader);
+            stateSize = 0;
+            stateRecord = (struct SnapshotStateRecord) { 0 };
+        }
+    }
+
+    // Blocks already in the file are referred to again, blocks closed since are appended. Both lists are in
+    // order of serial, and blocks missing from the history were dropped from it. When compacting, the blocks kept
+    // are copied over from the old file.
+    const int historyBlocks = getHistoryBlockCount();
+    struct SnapshotBlock *saved = blocks;
+    long long *savedSerials = serials;
+    const int savedCount = blockCount;
+    blocks = 0;
+    serials = 0;
+    blockCount = 0;
+    blockCapacity = 0;
+    long long live = sizeof(struct SnapshotHeader);
+    for (int i = 0, j = 0; i < historyBlocks; i++) {
+        const long long serial = getHistoryBlockSerial(i);
+        while (j < savedCount && savedSerials[j] < serial) j++;
+        if (j < savedCount && savedSerials[j] == serial) {
+            struct SnapshotBlock block = saved[j];
+            if (previousFd >= 0) {
+                addPiece((struct SnapshotPiece) { .offset = fileSize, .source = block.offset, .size = block.size });
+                block.offset = fileSize;
+                fileSize += block.size;
+            }
+            addBlock(block, serial);
+            live += block.size;
+            continue;
+        }
+
+        struct SnapshotBlock block = { .offset = fileSize };
+        const unsigned char *data = readHistoryBlock(i, &block.size, &block.rawSize);
+        if (!data) {
+            free(saved);
+            free(savedSerials);
+            disableSnapshot(previousFd, newPath);
+            return;
+        }
+        addBlockData(data, block.size, fileSize);
+        block.hash = hashBytes(data, block.size);
+        fileSize += block.size;
+        live += block.size;
+        addBlock(block, serial);
+    }
+    free(saved);
+    free(savedSerials);
+
+    int openSize, openRows;
+    const unsigned char *open = getOpenHistoryRows(&openSize, &openRows);
+    const int screenRowsSize = encodeScreen(&screenRows, &screenRowsCapacity);
+    const struct SnapshotState current = {
+        .screenSize = renderContext.screenTileSize,
+        .cursorPosition = renderContext.screen == &renderContext.primaryScreen
+            ? renderContext.cursorPosition : renderContext.primaryScreen.savedCursorPosition,
+        .blockCount = blockCount,
+        .openRows = openRows,
+        .openSize = openSize,
+        .screenRowsSize = screenRowsSize
+    };
+
+    const int size = sizeof(current) + blockCount * sizeof(struct SnapshotBlock) + openSize + screenRowsSize;
+    unsigned char *record = malloc(size);
+    unsigned char *end = record;
+    memcpy(end, &current, sizeof(current));
+    end += sizeof(current);
+    if (blockCount > 0) {
+        memcpy(end, blocks, blockCount * sizeof(struct SnapshotBlock));
+        end += blockCount * sizeof(struct SnapshotBlock);
+    }
+    if (openSize > 0) {
+        memcpy(end, open, openSize);
+        end += openSize;
+    }
+    memcpy(end, screenRows, screenRowsSize);
+
+    if (size == stateSize && memcmp(record, state, size) == 0) {
+        free(record);
+        return;
+    }
+    free(state);
+    state = record;
+    stateSize = size;
+
+    const struct SnapshotStateRecord written = {
+        .offset = fileSize,
+        .size = stateSize,
+        .hash = hashBytes(state, stateSize)
+    };
+    pending.fd = snapshotFd;
+    pending.previousFd = previousFd;
+    if (previousFd >= 0) {
+        memcpy(pending.newPath, newPath, sizeof(newPath));
+    }
+    pending.stateOffset = fileSize;
+    pending.header = (struct SnapshotHeader) {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .states = { written, stateRecord }
+    };
+    fileSize += stateSize;
+    liveSize = live + stateSize + stateRecord.size;
+    stateRecord = written;
+
+    atomic_store(&writing, 1);
+    if (pthread_create(&writer, 0, writeSnapshot, 0) != 0) {
+        atomic_store(&writing, 0);
+        disableSnapshot(previousFd, newPath);
+        return;
+    }
+    writerStarted = 1;
+}
+
+/**
+ * Removes the snapshot when the window is closed, so the next terminal starts a new session. A write still in
+ * progress is waited for first.
+*/
+void closeSnapshot() {
+    if (!waitForSnapshotWrite() && pending.previousFd >= 0) {
+        unlink(pending.newPath);
+        close(pending.previousFd);
+    }
+    if (snapshotFd >= 0) {
+        unlink(snapshotPath);
+        close(snapshotFd);
+        snapshotFd = -1;
+    }
+    free(snapshotPath);
+    free(blocks);
+    free(serials);
+    free(state);
+    free(screenRows);
+    free(pending.pieces);
+    free(pending.data);
+    snapshotPath = 0;
+    blocks = 0;
+    serials = 0;
+    state = 0;
+    screenRows = 0;
+    blockCount = blockCapacity = stateSize = screenRowsCapacity = 0;
+    stateRecord = (struct SnapshotStateRecord) { 0 };
+    pending = (struct SnapshotWrite) { .previousFd = -1 };
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+/**
+ * Snapshot of the session, kept on disk so that the primary screen, its scrollback and the history are back after
+ * a crash or a reboot. The compressed history blocks are appended to the file as they are closed and never written
+ * again, and every few seconds the rest of the state, which is small, is appended after them and the header is
+ * pointed at it. Restoring maps the file and hands the blocks to the history as they are, so nothing is parsed
+ * again. The file is written by a thread of its own, so a slow disk does not hold up the frame loop. The snapshot
+ * is removed when the window is closed, since the session then ended on purpose.
+*/
+// Seconds between updates of the snapshot.
+#define SNAPSHOT_INTERVAL 2
+// Bytes of the file no longer referred to before it is written again from scratch.
+#define SNAPSHOT_COMPACT_SIZE (4 * 1024 * 1024)
+
+void restoreSnapshot();
+void updateSnapshot();
+void closeSnapshot();
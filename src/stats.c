@@ -0,0 +1,220 @@
+#ifdef PARSER_STATS
+
+#include <signal.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+#define CSI_FINAL_FIRST 0x40
+#define CSI_FINAL_LAST 0x7E
+#define CSI_FINAL_COUNT (CSI_FINAL_LAST - CSI_FINAL_FIRST + 1)
+// No private marker, followed by the markers '<', '=', '>' and '?'.
+#define CSI_MARKER_COUNT 5
+#define PRIVATE_MODE_LIMIT 2048
+#define SGR_LIMIT 108
+#define OSC_LIMIT 128
+
+struct ParserStats {
+    unsigned long bytes[3];
+    // Indices 0x00 - 0x1F are C0 codes, 0x20 is DEL.
+    unsigned long c0[0x21];
+    unsigned long csi[CSI_MARKER_COUNT][CSI_FINAL_COUNT];
+    // The last entry of each array counts values outside of the tracked range.
+    unsigned long privateModes[PRIVATE_MODE_LIMIT + 1];
+    unsigned long sgr[SGR_LIMIT + 1];
+    unsigned long osc[OSC_LIMIT + 1];
+};
+
+static struct ParserStats stats;
+static volatile sig_atomic_t dumpRequested = 0;
+
+static const char CSI_MARKERS[CSI_MARKER_COUNT] = { 0, '<', '=', '>', '?' };
+
+static const char *csiName(char marker, unsigned char finalByte) {
+    if (marker == '?') {
+        switch (finalByte) {
+            case 'h': return "DECSET";
+            case 'l': return "DECRST";
+            default: return "";
+        }
+    } else if (marker != 0) {
+        return "";
+    }
+
+    switch (finalByte) {
+        case '@': return "ICH";
+        case 'A': return "CUU";
+        case 'B': return "CUD";
+        case 'C': return "CUF";
+        case 'D': return "CUB";
+        case 'E': return "CNL";
+        case 'F': return "CPL";
+        case 'G': return "CHA";
+        case 'H': return "CUP";
+        case 'J': return "ED";
+        case 'K': return "EL";
+        case 'L': return "IL";
+        case 'M': return "DL";
+        case 'P': return "DCH";
+        case 'S': return "SU";
+        case 'T': return "SD";
+        case 'X': return "ECH";
+        case 'b': return "REP";
+        case 'd': return "VPA";
+        case 'f': return "HVP";
+        case 'h': return "SM";
+        case 'l': return "RM";
+        case 'm': return "SGR";
+        case 'n': return "DSR";
+        case 'r': return "DECSTBM";
+        default: return "";
+    }
+}
+
+static const char *c0Name(int index) {
+    static const char *names[0x21] = {
+        "NUL", "SOH", "STX", "ETX", "EOT", "ENQ", "ACK", "BEL", "BS", "HT", "LF", "VT", "FF", "CR", "SO", "SI",
+        "DLE", "DC1", "DC2", "DC3", "DC4", "NAK", "SYN", "ETB", "CAN", "EM", "SUB", "ESC", "FS", "GS", "RS", "US",
+        "DEL"
+    };
+    return names[index];
+}
+
+/**
+ * Parses a decimal integer starting at `*position`, advancing the position past it. Returns -1 if no digits are
+ * present.
+*/
+static int parseInteger(const unsigned char *sequence, int length, int *position) {
+    int value = -1;
+    while (*position < length && sequence[*position] >= '0' && sequence[*position] <= '9') {
+        value = (value < 0 ? 0 : value * 10) + (sequence[*position] - '0');
+        if (value > 0xFFFFF) value = 0xFFFFF;
+        (*position)++;
+    }
+    return value;
+}
+
+static void onDumpSignal(int signal) {
+    dumpRequested = 1;
+}
+
+void statsInit() {
+    signal(SIGUSR1, onDumpSignal);
+}
+
+void statsCountByte(enum StatsByteClass byteClass) {
+    stats.bytes[byteClass]++;
+}
+
+void statsCountBytes(enum StatsByteClass byteClass, int count) {
+    stats.bytes[byteClass] += count;
+}
+
+void statsCountC0(unsigned char byte) {
+    stats.c0[byte == 0x7F ? 0x20 : (byte & 0x1F)]++;
+}
+
+void statsCountCSI(const unsigned char *sequence, int length) {
+    if (length == 0) return;
+
+    const unsigned char finalByte = sequence[length - 1];
+    if (finalByte < CSI_FINAL_FIRST || finalByte > CSI_FINAL_LAST) return;
+
+    int marker = 0;
+    for (int i = 1; i < CSI_MARKER_COUNT; i++) {
+        if (sequence[0] == CSI_MARKERS[i]) {
+            marker = i;
+        }
+    }
+    stats.csi[marker][finalByte - CSI_FINAL_FIRST]++;
+
+    // Count each DEC private mode set or reset by the sequence.
+    if (CSI_MARKERS[marker] == '?' && (finalByte == 'h' || finalByte == 'l')) {
+        int position = 1;
+        while (position < length - 1) {
+            int mode = parseInteger(sequence, length - 1, &position);
+            if (mode >= 0) {
+                stats.privateModes[mode < PRIVATE_MODE_LIMIT ? mode : PRIVATE_MODE_LIMIT]++;
+            }
+            position++;
+        }
+    }
+}
+
+void statsCountSGR(int command) {
+    stats.sgr[command >= 0 && command < SGR_LIMIT ? command : SGR_LIMIT]++;
+}
+
+void statsCountOSC(const unsigned char *sequence, int length) {
+    int position = 0;
+    int command = parseInteger(sequence, length, &position);
+    stats.osc[command >= 0 && command < OSC_LIMIT ? command : OSC_LIMIT]++;
+}
+
+void statsPollDump() {
+    if (dumpRequested) {
+        dumpRequested = 0;
+        statsDump();
+    }
+}
+
+void statsDump() {
+    unsigned long totalBytes = stats.bytes[STATS_BYTES_TEXT] + stats.bytes[STATS_BYTES_CONTROL] + stats.bytes[STATS_BYTES_SEQUENCE];
+    double percent = totalBytes > 0 ? 100.0 / totalBytes : 0;
+
+    printf("Parser statistics\n");
+    printf("\tBytes:          %lu\n", totalBytes);
+    printf("\tText bytes:     %lu (%.1f%%)\n", stats.bytes[STATS_BYTES_TEXT], stats.bytes[STATS_BYTES_TEXT] * percent);
+    printf("\tControl bytes:  %lu (%.1f%%)\n", stats.bytes[STATS_BYTES_CONTROL], stats.bytes[STATS_BYTES_CONTROL] * percent);
+    printf("\tSequence bytes: %lu (%.1f%%)\n", stats.bytes[STATS_BYTES_SEQUENCE], stats.bytes[STATS_BYTES_SEQUENCE] * percent);
+
+    printf("\tC0 controls:\n");
+    for (int i = 0; i < 0x21; i++) {
+        if (stats.c0[i] == 0) continue;
+        printf("\t\t%-4s %lu\n", c0Name(i), stats.c0[i]);
+    }
+
+    printf("\tCSI sequences:\n");
+    for (int marker = 0; marker < CSI_MARKER_COUNT; marker++) {
+        for (int i = 0; i < CSI_FINAL_COUNT; i++) {
+            if (stats.csi[marker][i] == 0) continue;
+            const unsigned char finalByte = CSI_FINAL_FIRST + i;
+            const char markerString[2] = { CSI_MARKERS[marker], '\0' };
+            printf("\t\tCSI %1s%c %-8s %lu\n", markerString, finalByte, csiName(CSI_MARKERS[marker], finalByte), stats.csi[marker][i]);
+        }
+    }
+
+    printf("\tDEC private modes:\n");
+    for (int i = 0; i <= PRIVATE_MODE_LIMIT; i++) {
+        if (stats.privateModes[i] == 0) continue;
+        if (i == PRIVATE_MODE_LIMIT) {
+            printf("\t\tother %lu\n", stats.privateModes[i]);
+        } else {
+            printf("\t\t?%d %lu\n", i, stats.privateModes[i]);
+        }
+    }
+
+    printf("\tSGR attributes:\n");
+    for (int i = 0; i <= SGR_LIMIT; i++) {
+        if (stats.sgr[i] == 0) continue;
+        if (i == SGR_LIMIT) {
+            printf("\t\tother %lu\n", stats.sgr[i]);
+        } else {
+            printf("\t\t%d %lu\n", i, stats.sgr[i]);
+        }
+    }
+
+    printf("\tOSC commands:\n");
+    for (int i = 0; i <= OSC_LIMIT; i++) {
+        if (stats.osc[i] == 0) continue;
+        if (i == OSC_LIMIT) {
+            printf("\t\tother %lu\n", stats.osc[i]);
+        } else {
+            printf("\t\t%d %lu\n", i, stats.osc[i]);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+/**
+ * Optional instrumentation for the escape sequence parser. Counters are only compiled in when PARSER_STATS is
+ * defined (`make STATS=1`); otherwise every macro below expands to nothing, including its arguments.
+ *
+ * The histogram is printed when the terminal exits, or on demand by sending SIGUSR1 to the process.
+*/
+
+enum StatsByteClass {
+    STATS_BYTES_TEXT,
+    STATS_BYTES_CONTROL,
+    STATS_BYTES_SEQUENCE
+};
+
+#ifdef PARSER_STATS
+
+void statsInit();
+void statsCountByte(enum StatsByteClass byteClass);
+void statsCountBytes(enum StatsByteClass byteClass, int count);
+void statsCountC0(unsigned char byte);
+void statsCountCSI(const unsigned char *sequence, int length);
+void statsCountSGR(int command);
+void statsCountOSC(const unsigned char *sequence, int length);
+void statsPollDump();
+void statsDump();
+
+#define STATS_INIT()                        statsInit()
+#define STATS_BYTE(byteClass)               statsCountByte(byteClass)
+#define STATS_BYTES(byteClass, count)       statsCountBytes(byteClass, count)
+#define STATS_C0(byte)                      statsCountC0(byte)
+#define STATS_CSI(sequence, length)         statsCountCSI(sequence, length)
+#define STATS_SGR(command)                  statsCountSGR(command)
+#define STATS_OSC(sequence, length)         statsCountOSC(sequence, length)
+#define STATS_POLL_DUMP()                   statsPollDump()
+#define STATS_DUMP()                        statsDump()
+
+#else
+
+#define STATS_INIT()
+#define STATS_BYTE(byteClass)
+#define STATS_BYTES(byteClass, count)
+#define STATS_C0(byte)
+#define STATS_CSI(sequence, length)
+#define STATS_SGR(command)
+#define STATS_OSC(sequence, length)
+#define STATS_POLL_DUMP()
+#define STATS_DUMP()
+
+#endif
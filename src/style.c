@@ -0,0 +1,208 @@
+#include <string.h>
+
+#include "terminal.h"
+#include "style.h"
+#include "hyperlink.h"
+#include "colors.h"
+
+#define STYLE_HASH_SIZE (STYLE_TABLE_SIZE * 2)
+
+extern struct RenderContext renderContext;
+
+static unsigned int styles[STYLE_TABLE_SIZE];
+// Ids that were never used start at nextId, ids freed by collectStyles() are kept in freeIds.
+static int nextId = 1;
+static unsigned short freeIds[STYLE_TABLE_SIZE];
+static int freeCount = 0;
+static int styleCount = 1;
+// Unused styles are collected at the next frame once this many are taken, see collectStyles().
+static int collectAt = STYLE_TABLE_SIZE * 3 / 4;
+// Open addressing table of style ids. 0 marks an empty slot, since the default style is never looked up.
+static unsigned short styleTable[STYLE_HASH_SIZE];
+// Range of styles that changed since the table was last written to each shader context slot.
+static int dirtyStart[SHADER_CONTEXT_SLOTS];
+static int dirtyEnd[SHADER_CONTEXT_SLOTS];
+// Styles of the current colors, kept until the colors change. -1 forces a lookup.
+static int currentForeground = -1;
+static int currentBackground = -1;
+static int currentLink = HYPERLINK_NONE;
+static int currentStyle;
+static int blankBackground = -1;
+static int blankStyle;
+
+static void markStyleDirty(int id) {
+    for (int slot = 0; slot < SHADER_CONTEXT_SLOTS; slot++) {
+        if (dirtyStart[slot] == dirtyEnd[slot]) {
+            dirtyStart[slot] = id;
+            dirtyEnd[slot] = id + 1;
+        } else {
+            if (id < dirtyStart[slot]) dirtyStart[slot] = id;
+            if (id >= dirtyEnd[slot]) dirtyEnd[slot] = id + 1;
+        }
+    }
+}
+
+static unsigned int hashStyle(unsigned int style) {
+    return (style * 0x9E3779B1u) % STYLE_HASH_SIZE;
+}
+
+static void insertStyle(int id) {
+    unsigned int slot = hashStyle(styles[id]);
+    while (styleTable[slot] != 0) {
+        slot = (slot + 1) % STYLE_HASH_SIZE;
+    }
+    styleTable[slot] = id;
+}
+
+/**
+ * Returns the id of a style, adding it to the table the first time it is seen. Once the table is full, new styles
+ * use the default style until unused styles are collected.
+*/
+int internStyle(unsigned int style) {
+    if (style == 0) {
+        return STYLE_DEFAULT;
+    }
+
+    unsigned int slot = hashStyle(style);
+    while (styleTable[slot] != 0) {
+        if (styles[styleTable[slot]] == style) {
+            return styleTable[slot];
+        }
+        slot = (slot + 1) % STYLE_HASH_SIZE;
+    }
+
+    int id;
+    if (freeCount > 0) {
+        id = freeIds[--freeCount];
+    } else if (nextId < STYLE_TABLE_SIZE) {
+        id = nextId++;
+    } else {
+        collectAt = styleCount;
+        return STYLE_DEFAULT;
+    }
+
+    styles[id] = style;
+    styleTable[slot] = id;
+    holdHyperlink(getStyleLink(style));
+    styleCount++;
+    markStyleDirty(id);
+    return id;
+}
+
+unsigned int getStyle(int id) {
+    return styles[id];
+}
+
+/**
+ * Returns the style for text printed with the current colors and hyperlink.
+*/
+int getCurrentStyle() {
+    if (renderContext.foregroundColor != currentForeground || renderContext.backgroundColor != currentBackground
+            || getCurrentHyperlink() != currentLink) {
+        currentForeground = renderContext.foregroundColor;
+        currentBackground = renderContext.backgroundColor;
+        currentLink = getCurrentHyperlink();
+        currentStyle = internStyle(packStyle(currentForeground, currentBackground, 0)
+            | ((unsigned int) currentLink << STYLE_LINK_SHIFT));
+    }
+    return currentStyle;
+}
+
+/**
+ * Returns the style of erased cells, which take the current background color.
+*/
+int getBlankStyle() {
+    if (renderContext.backgroundColor != blankBackground) {
+        blankBackground = renderContext.backgroundColor;
+        blankStyle = internStyle(packStyle(PALETTE_DEFAULT, blankBackground, 0));
+    }
+    return blankStyle;
+}
+
+/**
+ * Frees the styles that no cell of the grid refers to, along with their references to hyperlinks, and then the
+ * 24-bit colors no remaining style refers to. Cells are the only references to styles, apart from the cached
+ * current styles, and rows that scroll into the history store their styles and colors rather than ids, so a sweep
+ * of the grid is enough to count them.
+*/
+static void collectStyles() {
+    static unsigned char used[STYLE_TABLE_SIZE];
+    memset(used, 0, sizeof(used));
+
+    const struct CellGrid *grid = renderContext.grid;
+    for (int row = 0; grid && row < grid->rows; row++) {
+        const unsigned int *cells = &grid->cells[row * grid->columns];
+        for (int x = 0; x < grid->blankFrom[row]; x++) {
+            used[cells[x] >> CELL_STYLE_SHIFT] = 1;
+        }
+        if (grid->blankFrom[row] < grid->columns) {
+            used[grid->blankCell[row] >> CELL_STYLE_SHIFT] = 1;
+        }
+    }
+
+    // Palette entries of 24-bit colors are held by the styles kept and by the current and saved colors.
+    static unsigned char usedColors[PALETTE_SIZE];
+    memset(usedColors, 0, sizeof(usedColors));
+    usedColors[renderContext.foregroundColor] = usedColors[renderContext.backgroundColor] = 1;
+    usedColors[renderContext.primaryScreen.savedForegroundColor] = 1;
+    usedColors[renderContext.primaryScreen.savedBackgroundColor] = 1;
+    usedColors[renderContext.alternateScreen.savedForegroundColor] = 1;
+    usedColors[renderContext.alternateScreen.savedBackgroundColor] = 1;
+
+    memset(styleTable, 0, sizeof(styleTable));
+    freeCount = 0;
+    styleCount = 1;
+    for (int id = 1; id < nextId; id++) {
+        if (used[id]) {
+            insertStyle(id);
+            styleCount++;
+            usedColors[(styles[id] >> STYLE_FOREGROUND_SHIFT) & STYLE_COLOR_MASK] = 1;
+            usedColors[(styles[id] >> STYLE_BACKGROUND_SHIFT) & STYLE_COLOR_MASK] = 1;
+        } else {
+            // Ids that were already free have a style of 0, which holds no link.
+            releaseHyperlink(getStyleLink(styles[id]));
+            styles[id] = 0;
+            freeIds[freeCount++] = id;
+        }
+    }
+    collectTrueColors(usedColors);
+
+    currentForeground = -1;
+    currentBackground = -1;
+    blankBackground = -1;
+    // Collect again only once half of the remaining entries are taken.
+    collectAt = styleCount + (STYLE_TABLE_SIZE - styleCount) / 2;
+}
+
+/**
+ * Has unused styles collected at the next frame, for when something they hold on to has run out.
+*/
+void collectStylesSoon() {
+    collectAt = styleCount;
+}
+
+/**
+ * Marks every style in use as changed, so that the whole table is written to each slot of a new shader context.
+*/
+void invalidateShaderStyles() {
+    for (int slot = 0; slot < SHADER_CONTEXT_SLOTS; slot++) {
+        dirtyStart[slot] = 0;
+        dirtyEnd[slot] = nextId;
+    }
+}
+
+/**
+ * Writes styles added since the current shader context slot was last written. Runs once per frame, which is also
+ * when unused styles are collected, since no cells are being copied between grids then.
+*/
+void updateShaderStyles() {
+    if (styleCount >= collectAt) {
+        collectStyles();
+    }
+
+    const int slot = renderContext.shaderContextSlot;
+    for (int i = dirtyStart[slot]; i < dirtyEnd[slot]; i++) {
+        renderContext.shaderContext->styles[i] = styles[i];
+    }
+    dirtyStart[slot] = dirtyEnd[slot] = 0;
+}
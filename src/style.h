@@ -0,0 +1,17 @@
+#pragma once
+
+/**
+ * Cells refer to their colors and attributes by an id into a table of styles that is shared with the text shader.
+ * Styles are interned as they are used, so a screen showing a few dozen styles takes a few dozen entries. Style 0
+ * is the default colors without attributes.
+*/
+#define STYLE_DEFAULT 0
+#define STYLE_TABLE_SIZE 4096
+
+int internStyle(unsigned int style);
+unsigned int getStyle(int id);
+int getCurrentStyle();
+int getBlankStyle();
+void collectStylesSoon();
+void invalidateShaderStyles();
+void updateShaderStyles();
@@ -12,13 +12,23 @@
 #include <pty.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "base64.h"
+#include "cluster.h"
+#include "colors.h"
 #include "commands.h"
+#include "effects.h"
 #include "glyph.h"
+#include "grid.h"
+#include "hyperlink.h"
 #include "keys.h"
+#include "screen.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "terminal.h"
 
 struct Buffer {
@@ -26,6 +36,29 @@ struct Buffer {
     unsigned char *data;
 };
 
+#define STRINGIFY(value) #value
+#define SHADER_DEFINE(name) "#define " #name " " STRINGIFY(name) "\n"
+
+/**
+ * Definitions added to every shader after its #version line, so that sizes and the cell layout are only written
+ * down once, in the C headers.
+*/
+static const char SHADER_DEFINITIONS[] =
+    SHADER_DEFINE(ATLAS_WIDTH)
+    SHADER_DEFINE(ATLAS_HEIGHT)
+    SHADER_DEFINE(PALETTE_SIZE)
+    SHADER_DEFINE(STYLE_TABLE_SIZE)
+    SHADER_DEFINE(GLYPH_TABLE_SIZE)
+    SHADER_DEFINE(CELL_GLYPH_SHIFT)
+    SHADER_DEFINE(CELL_GLYPH_MASK)
+    SHADER_DEFINE(CELL_STYLE_SHIFT)
+    SHADER_DEFINE(CELL_STYLE_MASK)
+    SHADER_DEFINE(STYLE_FOREGROUND_SHIFT)
+    SHADER_DEFINE(STYLE_BACKGROUND_SHIFT)
+    SHADER_DEFINE(STYLE_COLOR_MASK)
+    SHADER_DEFINE(STYLE_ATTRIBUTE_SHIFT)
+    SHADER_DEFINE(STYLE_ATTRIBUTE_MASK);
+
 struct RenderContext renderContext;
 extern FT_Face face;
 
@@ -75,16 +108,45 @@ static void scrollCallback(GLFWwindow *window, double xOffset, double yOffset) {
     if (yOffset < 0 && renderContext.scrollOffset > 0) {
         renderContext.scrollOffset -= 1;
         updateShaderBuffer = 1;
-    } else if (yOffset > 0 && renderContext.scrollOffset < MAX_ROWS - renderContext.screenTileSize.y) {
+    } else if (yOffset > 0 && renderContext.scrollOffset < getScrollbackRows()) {
         renderContext.scrollOffset += 1;
         updateShaderBuffer = 1;
     }
 
     if (updateShaderBuffer) {
-        renderContext.shaderContext->glyphIndicesRowOffset = renderContext.glyphIndicesRowOffset - renderContext.scrollOffset;
+        renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
     }
 }
 
+/**
+ * Opens the hyperlink under the mouse on control-click.
+*/
+static void mouseButtonCallback(GLFWwindow *window, int button, int action, int mods) {
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS || !(mods & GLFW_MOD_CONTROL)) {
+        return;
+    }
+
+    // Cursor positions are in screen coordinates, which differ from framebuffer pixels on scaled displays.
+    double cursorX, cursorY;
+    int windowWidth, windowHeight;
+    glfwGetCursorPos(window, &cursorX, &cursorY);
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+    const double pixelX = cursorX * renderContext.screenSize.x / windowWidth - renderContext.windowPadding[2];
+    const double pixelY = cursorY * renderContext.screenSize.y / windowHeight - renderContext.windowPadding[0];
+    const int x = (int) floor(pixelX / renderContext.screenGlyphSize.x);
+    const int y = (int) floor(pixelY / renderContext.screenGlyphSize.y);
+    if (x < 0 || y < 0 || x >= renderContext.screenTileSize.x || y >= renderContext.screenTileSize.y) {
+        return;
+    }
+
+    const unsigned int cell = getDisplayedCell(x, y);
+    openHyperlink(getStyleLink(getStyle(cell >> CELL_STYLE_SHIFT)));
+}
+
+static void focusCallback(GLFWwindow *window, int focused) {
+    renderContext.windowFocused = focused;
+}
+
 int lastIndexOf(char *string, int size, char c) {
     for (int i = size; i >= 0; i--) {
         if (string[i] == c) {
@@ -123,6 +185,8 @@ void spawnShell() {
         // be better, but hasn't worked yet.
         int flags = fcntl(controlFd, F_GETFL, 0);
         fcntl(controlFd, F_SETFL, flags | O_NONBLOCK);
+        // Keep the shell's terminal out of the processes started to open links.
+        fcntl(controlFd, F_SETFD, FD_CLOEXEC);
     }
     renderContext.controlFd = controlFd;
 }
@@ -151,8 +215,14 @@ GLuint compileShader(char* shaderPath, GLenum shaderType) {
     int bytesWritten = fread(fileBuffer, sizeof(char), fileSize, file);
     fileBuffer[bytesWritten] = '\0';
 
+    // The #version line must come first, so the shared definitions are inserted after it.
+    char *versionEnd = strchr(fileBuffer, '\n');
+    const int versionLength = versionEnd ? versionEnd - fileBuffer + 1 : 0;
+    const char *sources[3] = { fileBuffer, SHADER_DEFINITIONS, fileBuffer + versionLength };
+    const GLint sourceLengths[3] = { versionLength, -1, -1 };
+
     const GLuint shader = glCreateShader(shaderType);
-    glShaderSource(shader, 1, (const char *const *) &fileBuffer, 0);
+    glShaderSource(shader, 3, sources, sourceLengths);
     glCompileShader(shader);
 
     GLint success;
@@ -183,7 +253,7 @@ void renderSetup() {
 
     glfwSetErrorCallback(errorCallback);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     GLFWwindow* window = glfwCreateWindow(960, 480, "terminal", 0, 0);
@@ -195,6 +265,9 @@ void renderSetup() {
     glfwSetWindowSizeLimits(window, 300, 20, GLFW_DONT_CARE, GLFW_DONT_CARE);
     glfwSetKeyCallback(window, keyCallback);
     glfwSetScrollCallback(window, scrollCallback);
+    glfwSetMouseButtonCallback(window, mouseButtonCallback);
+    glfwSetWindowFocusCallback(window, focusCallback);
+    renderContext.windowFocused = glfwGetWindowAttrib(window, GLFW_FOCUSED);
     glfwMakeContextCurrent(window);
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
     glfwSwapInterval(1);
@@ -219,25 +292,16 @@ void renderSetup() {
 
     // Setup vertices and shaders for text area
 
-    GLuint vao, vbo, shaderContextId;
+    GLuint vao, vbo;
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
-    glGenBuffers(1, &shaderContextId);
     renderContext.textVAO = vao;
-    renderContext.shaderContextId = shaderContextId;
 
     glBindVertexArray(vao);
 
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(rectangleVertices), rectangleVertices, GL_STATIC_DRAW);
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, shaderContextId);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(struct TextShaderContext), 0, GL_DYNAMIC_COPY);
-
-    const int shaderContextIndex = 2;
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, shaderContextIndex, shaderContextId);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
     glGenTextures(1, &renderContext.atlasTextureId);
     glBindTexture(GL_TEXTURE_2D, renderContext.atlasTextureId);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, ATLAS_WIDTH * renderContext.atlasGlyphSize.x, ATLAS_HEIGHT * renderContext.atlasGlyphSize.y, 0, GL_RED, GL_UNSIGNED_BYTE, 0);
@@ -262,6 +326,7 @@ void renderSetup() {
     glVertexAttribPointer(vertexPositionLocation, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*) 0);
 
     renderContext.paddingTransformLocation = glGetUniformLocation(renderContext.textProgramId, "paddingTransform");
+    renderContext.gridColumnsLocation = glGetUniformLocation(renderContext.textProgramId, "gridColumns");
 
     glUniform2f(glGetUniformLocation(renderContext.textProgramId, "windowPadding"), renderContext.windowPadding[2], renderContext.windowPadding[0]);
 
@@ -301,61 +366,23 @@ void sendKeyInputToShell() {
     renderContext.keyBuffer.currentIndex = 0;
 }
 
+/**
+ * Reads the available shell output into the buffer, up to its length. Returns the number of bytes read.
+*/
 int pollShell(int controlFd, struct Buffer *buffer) {
-    int i = 0;
-    while (i < buffer->length - 1) {
-        char c;
-        int bytesRead = read(controlFd, &c, 1);
-        if (bytesRead > -1) {
-            buffer->data[i++] = c;
-        } else {
+    int bytesRead = 0;
+    while (bytesRead < buffer->length) {
+        int result = read(controlFd, buffer->data + bytesRead, buffer->length - bytesRead);
+        if (result <= 0) {
             break;
         }
+        bytesRead += result;
     }
-    buffer->data[i] = 0;
-    return i;
+    return bytesRead;
 }
 
-void updateText(struct Buffer *buffer) {
-    struct TextShaderContext *shaderContext = renderContext.shaderContext;
-
-    // Should these be updated every time?
-    // TODO: move these to the baseline font setup function
-    shaderContext->atlasGlyphSize = renderContext.atlasGlyphSize;
-    shaderContext->screenGlyphSize = renderContext.screenGlyphSize;
-
-    for (int i = 0; i < buffer->length; i++) {
-        if (buffer->data[i] == '\0') break;
-
-        int codePoint, prevRowOffset = renderContext.glyphIndicesRowOffset;
-        if (!processTextByte(buffer->data[i], &codePoint)) {
-            // processTextByte can update the row offset in the case of a newline command. In this case, the previous text
-            // at the next row is cleared.
-            if (renderContext.glyphIndicesRowOffset != prevRowOffset) {
-                int newRowIndex = ((renderContext.cursorPosition.y + renderContext.glyphIndicesRowOffset) % MAX_ROWS) * MAX_CHARACTERS_PER_ROW;
-                memset(&shaderContext->glyphIndices[newRowIndex], 0, MAX_CHARACTERS_PER_ROW * sizeof(int));
-            }
-            continue;
-        }
-
-        // Reset scroll offset to jump back to current line when there are printed characters.
-        renderContext.scrollOffset = 0;
-
-        int atlasPosition = getGlyphAtlasPosition(codePoint);
-
-        int glyphIndex = ((renderContext.cursorPosition.y + renderContext.glyphIndicesRowOffset) % MAX_ROWS) * MAX_CHARACTERS_PER_ROW + renderContext.cursorPosition.x;
-        shaderContext->glyphIndicesRowOffset = renderContext.glyphIndicesRowOffset;
-        shaderContext->glyphIndices[glyphIndex] = atlasPosition;
-        shaderContext->glyphColors[glyphIndex] = renderContext.foregroundColor;
-
-        renderContext.cursorPosition.x++;
-
-        // TODO: this is kind of performing line wrapping...should that be handled here?
-        if (renderContext.cursorPosition.x >= renderContext.screenTileSize.x) {
-            renderContext.cursorPosition.x = 0;
-            renderContext.cursorPosition.y++;
-        }
-    }
+void updateText(struct Buffer *buffer, int length) {
+    processText(buffer->data, length);
 }
 
 void updatePaddingTransform() {
@@ -415,6 +442,68 @@ void updateCursorTransform() {
     glUniformMatrix4fv(renderContext.cursorTransformLocation, 1, GL_FALSE, (GLfloat*) mat);
 }
 
+/**
+ * Points the shader context and row map at the given slot of the shader context ring.
+*/
+static void selectShaderContextSlot(int slot) {
+    renderContext.shaderContextSlot = slot;
+    renderContext.shaderContext = renderContext.shaderContextSlots[slot];
+    renderContext.shaderRowMap = (struct ShaderRow *) ((char *) renderContext.shaderContext + renderContext.shaderRowMapOffset);
+}
+
+/**
+ * Replaces the shader context ring with one sized for the current grid and screen. Buffer storage is immutable, so
+ * a new buffer is created and the old one is released once the GPU has finished with it.
+*/
+void resizeShaderContext() {
+    if (renderContext.shaderContextId) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderContext.shaderContextId);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        glDeleteBuffers(1, &renderContext.shaderContextId);
+    }
+    for (int i = 0; i < SHADER_CONTEXT_SLOTS; i++) {
+        if (renderContext.shaderContextFences[i]) {
+            glDeleteSync(renderContext.shaderContextFences[i]);
+            renderContext.shaderContextFences[i] = 0;
+        }
+    }
+
+    // The shader context is a ring of slots in one persistently mapped buffer, so it is never mapped or copied
+    // by the driver during the render loop. Each slot holds the context followed by the row map, and both must
+    // start at the alignment required by glBindBufferRange.
+    GLint alignment;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    const struct CellGrid *grid = renderContext.grid;
+    const GLsizeiptr contextSize = sizeof(struct TextShaderContext) + (GLsizeiptr) grid->columns * grid->rows * sizeof(unsigned int);
+    const GLsizeiptr rowMapSize = renderContext.screenTileSize.y * sizeof(struct ShaderRow);
+    renderContext.shaderRowMapOffset = (contextSize + alignment - 1) / alignment * alignment;
+    renderContext.shaderContextStride = (renderContext.shaderRowMapOffset + rowMapSize + alignment - 1) / alignment * alignment;
+    const GLsizeiptr shaderContextSize = renderContext.shaderContextStride * SHADER_CONTEXT_SLOTS;
+    const GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &renderContext.shaderContextId);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderContext.shaderContextId);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, shaderContextSize, 0, mapFlags);
+    char *shaderContextMapping = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, shaderContextSize, mapFlags);
+    if (!shaderContextMapping) {
+        printf("Failed to map shader context buffer.\n");
+        exit(-1);
+    }
+    // Start from blank cells. Rows of the new grid are either cleared, which the shader does not read, or dirty.
+    memset(shaderContextMapping, 0, shaderContextSize);
+    for (int i = 0; i < SHADER_CONTEXT_SLOTS; i++) {
+        renderContext.shaderContextSlots[i] = (struct TextShaderContext *) (shaderContextMapping + i * renderContext.shaderContextStride);
+    }
+    selectShaderContextSlot(renderContext.shaderContextSlot);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    renderContext.shaderSizesDirty = SHADER_CONTEXT_ALL_SLOTS;
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
+    invalidateShaderPalette();
+    invalidateShaderStyles();
+    invalidateShaderGlyphs();
+}
+
 void onWindowResize(int newWidth, int newHeight) {
     renderContext.screenSize.x = newWidth;
     renderContext.screenSize.y = newHeight;
@@ -423,14 +512,26 @@ void onWindowResize(int newWidth, int newHeight) {
     newWidth -= renderContext.windowPadding[2] + renderContext.windowPadding[3];
     newHeight -= renderContext.windowPadding[0] + renderContext.windowPadding[1];
 
-    renderContext.screenTileSize = (struct Vec2i) {
+    struct Vec2i tileSize = {
         .x = newWidth / renderContext.screenGlyphSize.x,
         .y = newHeight / renderContext.screenGlyphSize.y
     };
+    if (tileSize.x < 1) tileSize.x = 1;
+    if (tileSize.y < 1) tileSize.y = 1;
+
+    // The grid and shader context are sized for the screen, so they are only replaced when the tile size changes.
+    if (tileSize.x != renderContext.screenTileSize.x || tileSize.y != renderContext.screenTileSize.y) {
+        resizeScreen(tileSize.x, tileSize.y);
+        renderContext.screenTileSize = tileSize;
+        // A region set for the old size may not fit the new one. Applications set it again once they see the size.
+        resetScrollRegion();
+        resizeShaderContext();
+        glUniform1i(renderContext.gridColumnsLocation, renderContext.grid->columns);
+    }
 
-    struct Vec2i screenExcess = {
-        .x = newWidth % renderContext.screenGlyphSize.x,
-        .y = newHeight % renderContext.screenGlyphSize.y
+    renderContext.screenExcess = (struct Vec2i) {
+        .x = newWidth - renderContext.screenTileSize.x * renderContext.screenGlyphSize.x,
+        .y = newHeight - renderContext.screenTileSize.y * renderContext.screenGlyphSize.y
     };
 
     if (renderContext.cursorPosition.x >= renderContext.screenTileSize.x) {
@@ -440,29 +541,68 @@ void onWindowResize(int newWidth, int newHeight) {
     if (renderContext.cursorPosition.y >= renderContext.screenTileSize.y) {
         renderContext.cursorPosition.y = renderContext.screenTileSize.y - 1;
     }
+    renderContext.rowMapDirty = SHADER_CONTEXT_ALL_SLOTS;
 
     updatePaddingTransform();
 
     // Update size related information in the shader context.
-    renderContext.shaderContext->screenSize = renderContext.screenSize;
-    renderContext.shaderContext->screenTileSize = renderContext.screenTileSize;
-    renderContext.shaderContext->screenExcess = screenExcess;
+    renderContext.shaderSizesDirty = SHADER_CONTEXT_ALL_SLOTS;
 
     // Inform pseudo-terminal of new window size
     struct winsize windowSize = {
         .ws_col = renderContext.screenTileSize.x,
         .ws_row = renderContext.screenTileSize.y
     };
-    ioctl(renderContext.controlFd, TIOCGWINSZ, &windowSize);
+    ioctl(renderContext.controlFd, TIOCSWINSZ, &windowSize);
 
     printf("Window size update: (%d, %d), screen tile size = (%d, %d), excess = (%d, %d), cursor = (%d, %d)\n",
         renderContext.screenSize.x, renderContext.screenSize.y, renderContext.screenTileSize.x, renderContext.screenTileSize.y,
-        screenExcess.x, screenExcess.y, renderContext.cursorPosition.x, renderContext.cursorPosition.y);
+        renderContext.screenExcess.x, renderContext.screenExcess.y, renderContext.cursorPosition.x, renderContext.cursorPosition.y);
+}
+
+/**
+ * Moves to the next slot of the shader context ring, waiting until the GPU has finished the frame that last read
+ * it. With three slots this only blocks when the CPU is more than two frames ahead of the GPU.
+*/
+void acquireShaderContextSlot() {
+    const int slot = (renderContext.shaderContextSlot + 1) % SHADER_CONTEXT_SLOTS;
+    GLsync fence = renderContext.shaderContextFences[slot];
+    if (fence) {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        renderContext.shaderContextFences[slot] = 0;
+    }
+
+    selectShaderContextSlot(slot);
+}
+
+void updateShaderSizes() {
+    const int slotBit = 1 << renderContext.shaderContextSlot;
+    if (!(renderContext.shaderSizesDirty & slotBit)) {
+        return;
+    }
+
+    struct TextShaderContext *shaderContext = renderContext.shaderContext;
+    shaderContext->atlasGlyphSize = renderContext.atlasGlyphSize;
+    shaderContext->screenGlyphSize = renderContext.screenGlyphSize;
+    shaderContext->screenSize = renderContext.screenSize;
+    shaderContext->screenTileSize = renderContext.screenTileSize;
+    shaderContext->screenExcess = renderContext.screenExcess;
+    renderContext.shaderSizesDirty &= ~slotBit;
 }
 
 void render() {
     glClear(GL_COLOR_BUFFER_BIT);
 
+    const int shaderContextIndex = 2;
+    const int rowMapIndex = 3;
+    const int slot = renderContext.shaderContextSlot;
+    const GLintptr slotOffset = slot * renderContext.shaderContextStride;
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, shaderContextIndex, renderContext.shaderContextId,
+        slotOffset, renderContext.shaderRowMapOffset);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, rowMapIndex, renderContext.shaderContextId,
+        slotOffset + renderContext.shaderRowMapOffset, renderContext.screenTileSize.y * sizeof(struct ShaderRow));
+
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, renderContext.atlasTextureId);
     glBindVertexArray(renderContext.textVAO);
@@ -477,6 +617,9 @@ void render() {
     glBindVertexArray(0);
     glUseProgram(0);
 
+    // The slot can be written again once the GPU has passed this point.
+    renderContext.shaderContextFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
     glfwSwapBuffers(renderContext.window);
 }
 
@@ -497,7 +640,11 @@ int main(int argc, char** argv) {
     Would be nice to do the sampling so that the font size can be changed without recreating the atlas texture.
     */
     renderContext.atlasFontHeight = 16;
-    renderContext.foregroundColor = 0x00FFFFFF;
+    renderContext.foregroundColor = PALETTE_DEFAULT;
+    renderContext.backgroundColor = PALETTE_DEFAULT;
+    // Programs can read the clipboard with OSC 52 only when enabled.
+    renderContext.allowClipboardRead = 0;
+    renderContext.scrollbackRows = 1000;
 
     renderContext.keyBuffer = (struct KeyBuffer) {
         .currentIndex = 0,
@@ -508,6 +655,10 @@ int main(int argc, char** argv) {
     renderContext.cursorPosition.y = 0;
 
     initKeyMappings();
+    initScreen();
+    initPalette();
+    initBase64();
+    STATS_INIT();
     char *fontPath = buildRelativePath("fonts/UbuntuMono-R.ttf");
     loadBaselineFont(fontPath);
     free(fontPath);
@@ -515,8 +666,16 @@ int main(int argc, char** argv) {
     initGlyphCache();
     spawnShell();
 
+    // The screen is sized for the window before the previous session is restored into it, and before any output
+    // of the shell is read.
+    int width, height;
+    glfwGetFramebufferSize(renderContext.window, &width, &height);
+    glUseProgram(renderContext.textProgramId);
+    onWindowResize(width, height);
+    restoreSnapshot();
+
     struct Buffer shellOutputBuffer;
-    shellOutputBuffer.length = 1024;
+    shellOutputBuffer.length = 256 * 1024;
     shellOutputBuffer.data = malloc(sizeof(char) * shellOutputBuffer.length);
 
     while (!glfwWindowShouldClose(renderContext.window)) {
@@ -524,14 +683,13 @@ int main(int argc, char** argv) {
             sendKeyInputToShell();
         }
 
+        STATS_POLL_DUMP();
+
         glUseProgram(renderContext.textProgramId);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderContext.shaderContextId);
-        GLvoid *ssboPointer = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(struct TextShaderContext), GL_MAP_WRITE_BIT);
-        renderContext.shaderContext = (struct TextShaderContext*) ssboPointer;
+        acquireShaderContextSlot();
 
         glfwPollEvents();
 
-        int width, height;
         glfwGetFramebufferSize(renderContext.window, &width, &height);
         if (width != renderContext.screenSize.x || height != renderContext.screenSize.y) {
             onWindowResize(width, height);
@@ -540,11 +698,20 @@ int main(int argc, char** argv) {
         int bytesRead = pollShell(renderContext.controlFd, &shellOutputBuffer);
         struct Vec2i previousCursorPosition = renderContext.cursorPosition;
         if (bytesRead > 0) {
-            updateText(&shellOutputBuffer);
+            updateText(&shellOutputBuffer, bytesRead);
         }
-
-        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        updateShaderSizes();
+        // The row map is updated first, since scrolling into the history loads rows into the grid. Glyphs are
+        // resolved from the visible rows, while the grid still lists the rows that changed.
+        updateShaderRowMap();
+        updateShaderGlyphs();
+        uploadGrid();
+        updateShaderPalette();
+        updateShaderStyles();
+        compactClusters();
+        updateSnapshot();
+
+        flushWindowEffects();
 
         if (renderContext.cursorPosition.x != previousCursorPosition.x || renderContext.cursorPosition.y != previousCursorPosition.y) {
             updateCursorTransform();
@@ -553,10 +720,16 @@ int main(int argc, char** argv) {
         render();
     }
 
+    STATS_DUMP();
+
     free(renderContext.characterAtlasMap);
     free(renderContext.keyBuffer.data);
     free(shellOutputBuffer.data);
+    closeSnapshot();
     freeGlyphCache();
+    freeClusters();
+    freeScreen();
+    freeHyperlinks();
 
     glfwDestroyWindow(renderContext.window);
     glfwTerminate();
@@ -6,10 +6,25 @@
 
 #include <cglm/cglm.h>
 
-#define MAX_CHARACTERS_PER_ROW 500
-#define MAX_ROWS 1000
-static const int ATLAS_WIDTH = 32;
-static const int ATLAS_HEIGHT = 32;
+#include "cell.h"
+#include "colors.h"
+#include "glyph.h"
+#include "style.h"
+
+// Number of copies of the shader context in the persistently mapped ring. Each frame writes to the copy the GPU
+// finished with longest ago, while the others may still be in use by earlier frames.
+#define SHADER_CONTEXT_SLOTS 3
+#define SHADER_CONTEXT_ALL_SLOTS ((1 << SHADER_CONTEXT_SLOTS) - 1)
+// Sets of dirty columns kept by the grid: one for each shader context slot, and one for the frame differ once it has
+// run on the grid.
+#define GRID_DIRTY_SETS (SHADER_CONTEXT_SLOTS + 1)
+#define GRID_FRAME_DIFF_SET SHADER_CONTEXT_SLOTS
+#define ATLAS_WIDTH 32
+#define ATLAS_HEIGHT 32
+
+_Static_assert(ATLAS_WIDTH * ATLAS_HEIGHT <= 0xFFFF + 1, "atlas positions must fit in the glyph table");
+_Static_assert(PALETTE_SIZE <= STYLE_COLOR_MASK + 1, "palette indices must fit in a style");
+_Static_assert(STYLE_TABLE_SIZE <= CELL_STYLE_MASK + 1, "style ids must fit in a cell");
 
 struct KeyBuffer {
     int currentIndex;
@@ -19,22 +34,62 @@ struct KeyBuffer {
 
 struct Vec2i { int x; int y; };
 
+/**
+ * The rows of one screen buffer. The primary screen's ring also holds the scrollback, while the alternate screen
+ * used by full-screen programs only has room for the visible rows.
+*/
+struct Screen {
+    // Maps each position of the ring to the row of the cell grid holding its cells. Lines are inserted,
+    // deleted and scrolled by permuting this map instead of copying cells.
+    int *rowMap;
+    // Number of positions in the ring.
+    int rowCount;
+    // Number of rows the ring has advanced, modulo rowCount. Screen row 0 is at this ring position.
+    int rowOffset;
+    // Number of scrollback rows in the ring. Older rows have been moved to the history.
+    int scrollbackCount;
+    // Screen rows bounding the scroll region (DECSTBM), inclusive.
+    int scrollRegionTop;
+    int scrollRegionBottom;
+    // Rotation of the rows within the scroll region. Screen row `top + i` shows the region's row
+    // `(i + shift) % height`, so scrolling a region only changes this value.
+    int scrollRegionShift;
+    // Cursor position and colors stored by saveCursor().
+    struct Vec2i savedCursorPosition;
+    int savedForegroundColor;
+    int savedBackgroundColor;
+};
+
 struct RenderContext {
     // Window information
     GLFWwindow *window;
+    int windowFocused;
     struct Vec2i screenSize;
     struct Vec2i screenTileSize;
     struct Vec2i cursorPosition;
+    // Set once a character is printed in the last column, where the cursor stays until the next character is printed
+    // and wraps the line. Anything else that moves the cursor clears it.
+    int wrapPending;
     struct KeyBuffer keyBuffer;
     int scrollOffset;
     // Pixel values for padding, [top, bottom, left, right]
     int windowPadding[4];
-    // A pointer mapped to the SSBO shader context struct. This pointer is only valid for a
-    // portion of the render loop, as the mapping occurs each frame.
+    // Cells of both screens, sized for the screen and scrollback. The grid is the authoritative copy, changed rows
+    // are copied to the shader context once per frame.
+    struct CellGrid *grid;
+    // Number of rows kept above the primary screen for scrolling back.
+    int scrollbackRows;
+    // Slot of the shader context ring written this frame, and pointers to its persistently mapped memory.
+    int shaderContextSlot;
     struct TextShaderContext *shaderContext;
+    struct ShaderRow *shaderRowMap;
+    // Bit mask of the ring slots whose sizes are out of date.
+    int shaderSizesDirty;
 
     // Psuedo-terminal information
     int controlFd;
+    // Whether OSC 52 queries may read the system clipboard.
+    int allowClipboardRead;
 
     // OpenGL information
     GLuint textProgramId;
@@ -42,8 +97,16 @@ struct RenderContext {
     GLuint textVAO;
     GLuint cursorVAO;
     GLuint shaderContextId;
+    // Distance between the slots of the shader context ring, and the offset of the row map within each slot. Both
+    // are aligned for glBindBufferRange.
+    GLsizeiptr shaderContextStride;
+    GLsizeiptr shaderRowMapOffset;
+    struct TextShaderContext *shaderContextSlots[SHADER_CONTEXT_SLOTS];
+    // Signalled once the GPU has finished the last frame that read each slot.
+    GLsync shaderContextFences[SHADER_CONTEXT_SLOTS];
     GLuint atlasTextureId;
     GLuint paddingTransformLocation;
+    GLuint gridColumnsLocation;
     GLuint cursorTransformLocation;
     GLuint cursorTimeLocation;
 
@@ -59,19 +122,28 @@ struct RenderContext {
     struct Vec2i atlasGlyphSize;
     // Vector containing the number of rows/columns in the atlas texture.
     struct Vec2i atlasTileSize;
+    // Pixels on the right and bottom of the screen that do not fit a full glyph.
+    struct Vec2i screenExcess;
+    // Palette indices of the current foreground and background colors, see colors.h.
     int foregroundColor;
     int backgroundColor;
-    int glyphIndicesRowOffset;
+    struct Screen primaryScreen;
+    struct Screen alternateScreen;
+    // The screen being displayed and written to, switched with CSI ? 1049 h/l.
+    struct Screen *screen;
+    // Bit mask of the ring slots whose visible row map is out of date.
+    int rowMapDirty;
+    // Codepoint of the last printed character, repeated by CSI b. -1 when nothing has been printed.
+    int lastCharacter;
     int lineSpacing;
     int maxBelowBaseline;
 };
 
+/**
+ * Start of each shader context slot. The cells of the whole grid follow the palette and the style and glyph tables,
+ * and the ShaderRow of each visible row is stored after them at shaderRowMapOffset.
+*/
 struct TextShaderContext {
-    // Number of rows to skip when reading from glyphIndices array. Used to implement a circular buffer.
-    int glyphIndicesRowOffset;
-    // Added as a simple method of aligning the C struct byte layout with the GLSL layout. GLSL expects the `atlasGlyphSize`
-    // struct to be aligned at an 8 byte boundary, so this 4 byte int puts it at the same spot in the C struct.
-    int padding0;
     // Pixel vector containing (advance, lineHeight) for glyphs in atlas texture.
     struct Vec2i atlasGlyphSize;
     // Pixel vector containing (advance, lineHeight) used when rendering to screen.
@@ -83,6 +155,47 @@ struct TextShaderContext {
     // Pixel vector containing the number of extra pixels on the right and bottom of the screen.
     // These areas do not fit a full glyph so are not used.
     struct Vec2i screenExcess;
-    int glyphIndices[MAX_CHARACTERS_PER_ROW * MAX_ROWS];
-    int glyphColors[MAX_CHARACTERS_PER_ROW * MAX_ROWS];
+    // Colors referenced by styles, as 0x00RRGGBB values.
+    int palette[PALETTE_SIZE];
+    // Styles referenced by cells, see cell.h.
+    unsigned int styles[STYLE_TABLE_SIZE];
+    // Atlas position of each glyph id, see glyph.h.
+    unsigned int glyphSlots[GLYPH_TABLE_SIZE];
+    // Packed cells, see cell.h, with the grid's column count as the row stride.
+    unsigned int cells[];
+};
+
+/**
+ * Row map entry telling the shader where to find the cells shown at a screen row. Cells from column blankFrom on
+ * are `blank` and are not read from the cells array.
+*/
+struct ShaderRow {
+    int row;
+    int blankFrom;
+    unsigned int blank;
+};
+
+/**
+ * CPU copy of the cells in the shader context, using the same layout. The primary screen and its scrollback use
+ * the first rows, followed by the alternate screen and the rows that show the history when scrolled back. For each
+ * slot of the shader context ring, every row tracks the range of columns written since that slot was last updated,
+ * and the dirty rows are listed so that an update only visits changed rows.
+*/
+struct CellGrid {
+    int columns;
+    int rows;
+    unsigned int *cells;
+    // Cells from blankFrom to the end of each row were erased to blankCell without being written, so erasing the
+    // rest of a row only moves blankFrom. A row with nothing erased this way has blankFrom equal to columns.
+    int *blankFrom;
+    unsigned int *blankCell;
+    // Whether each row was filled to the last column and continued on the next row, so the line can be reflowed.
+    unsigned char *wrapped;
+    // Dirty columns [dirtyStart, dirtyEnd) of each row. Clean rows have an empty range.
+    int *dirtyStart[GRID_DIRTY_SETS];
+    int *dirtyEnd[GRID_DIRTY_SETS];
+    int *dirtyRows[GRID_DIRTY_SETS];
+    int dirtyRowCount[GRID_DIRTY_SETS];
+    // Number of sets kept, which only includes GRID_FRAME_DIFF_SET once trackFrameDiff() was called.
+    int dirtySets;
 };
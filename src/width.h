@@ -0,0 +1,22 @@
+#pragma once
+
+/**
+ * Column widths of codepoints: 0 for combining marks and other characters drawn on the previous cell, 2 for East
+ * Asian wide and fullwidth characters, including most emoji, and 1 otherwise. Widths are looked up in a two level
+ * table generated by scripts/generate_width_table.py: the high bits of a codepoint select one of the distinct blocks
+ * of 256 widths, which are packed at 2 bits each.
+*/
+#define WIDTH_BLOCK_SHIFT 8
+
+extern const unsigned char WIDTH_BLOCKS[];
+extern const unsigned char WIDTH_BITS[];
+
+static inline int getCodepointWidth(int codePoint) {
+    // Nothing before the combining diacritical marks at U+0300 is narrow or zero width.
+    if (codePoint < 0x300 || codePoint >= 0x110000) {
+        return 1;
+    }
+    const int block = WIDTH_BLOCKS[codePoint >> WIDTH_BLOCK_SHIFT];
+    const int offset = codePoint & ((1 << WIDTH_BLOCK_SHIFT) - 1);
+    return (WIDTH_BITS[(block << WIDTH_BLOCK_SHIFT) / 4 + offset / 4] >> (offset % 4 * 2)) & 3;
+}